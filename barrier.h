@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include "cpu_relax.h"
+
+/*
+	Reusable barrier for a fixed number of threads (like std::barrier without the completion function).
+
+	The phase word counts completed phases in steps of 2, bit 0 tells the last thread to
+	arrive that somebody fell asleep and has to be notified. Threads that arrive early
+	spin on the phase word and only go to sleep if the others take a while.
+
+	A thread reads the phase before it arrives. This is fine, because the phase can't advance
+	before this thread has arrived, and nobody can arrive for the next phase before it advanced.
+
+	example usage:
+	barrier sync_point(4);
+	auto work = [&] { for (int step = 0; step < 10; ++step) { do_step(step); sync_point.arrive_and_wait(); } };
+	// start 4 threads running work, no thread starts step n+1 before all threads finished step n
+*/
+
+class barrier
+{
+	static constexpr std::uint32_t waiters_bit = 1;
+	static constexpr std::uint32_t phase_step = 2;
+
+	static constexpr int spin_count = 100;
+
+	const std::uint32_t expected;
+	std::atomic<std::uint32_t> arrived{ 0 };
+	std::atomic<std::uint32_t> phase{ 0 };
+
+public:
+
+	explicit barrier(std::uint32_t expected_) : expected(expected_)
+	{
+		assert(expected > 0);
+	}
+
+	barrier(const barrier& other) = delete;
+	barrier& operator=(const barrier& other) = delete;
+
+	void arrive_and_wait()
+	{
+		const std::uint32_t my_phase = phase.load(std::memory_order_acquire) & ~waiters_bit;
+
+		if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == expected)
+		{
+			// last one to arrive. Reset the counter before releasing the others, so that
+			// their arrivals for the next phase start counting at 0 again.
+			arrived.store(0, std::memory_order_relaxed);
+			if (phase.exchange(my_phase + phase_step, std::memory_order_release) & waiters_bit)
+			{
+				phase.notify_all();
+			}
+			return;
+		}
+
+		for (int i = 0; i < spin_count; ++i)
+		{
+			if ((phase.load(std::memory_order_acquire) & ~waiters_bit) != my_phase)
+			{
+				return;
+			}
+			cpu_relax();
+		}
+
+		std::uint32_t current = phase.fetch_or(waiters_bit, std::memory_order_acquire) | waiters_bit;
+		while ((current & ~waiters_bit) == my_phase)
+		{
+			phase.wait(current, std::memory_order_acquire);
+			current = phase.load(std::memory_order_acquire);
+		}
+	}
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+// single producer single consumer bounded queue (ring buffer)
+
+/*
+	Same idea as lock_free_queue_spsc, but instead of a linked list the elements live in a fixed
+	size array, so a full queue can push back on the producer and push/pop don't allocate.
+
+	head and tail only ever grow, the slot is index & mask. The producer only writes tail, the consumer
+	only writes head, each on its own cache line. Additionally both sides keep a private copy of the other
+	side's index and only reload it when the copy says the queue is full/empty, so in the common case
+	a push or pop doesn't touch the other side's cache line at all.
+
+	The bulk functions publish all elements with a single store to tail/head.
+*/
+
+template <typename T>
+class bounded_queue_spsc
+{
+private:
+
+	struct slot
+	{
+		alignas(T) unsigned char storage[sizeof(T)];
+		T* get() { return std::launder(reinterpret_cast<T*>(storage)); }
+	};
+
+	const std::size_t mask;
+	std::unique_ptr<slot[]> slots;
+
+	alignas(64) std::atomic<std::size_t> head{ 0 };	// next slot to read, written by the consumer
+	std::size_t cached_tail = 0;						// consumer's copy of tail
+
+	alignas(64) std::atomic<std::size_t> tail{ 0 };	// next slot to write, written by the producer
+	std::size_t cached_head = 0;						// producer's copy of head
+
+	// producer only
+	std::size_t free_slots(std::size_t t, std::size_t wanted)
+	{
+		std::size_t free = capacity() - (t - cached_head);
+		if (free < wanted)
+		{
+			cached_head = head.load(std::memory_order_acquire);
+			free = capacity() - (t - cached_head);
+		}
+		return free;
+	}
+
+	// consumer only
+	std::size_t available(std::size_t h, std::size_t wanted)
+	{
+		std::size_t avail = cached_tail - h;
+		if (avail < wanted)
+		{
+			cached_tail = tail.load(std::memory_order_acquire);
+			avail = cached_tail - h;
+		}
+		return avail;
+	}
+
+public:
+
+	// capacity is rounded up to the next power of two
+	explicit bounded_queue_spsc(std::size_t min_capacity)
+		: mask(std::bit_ceil(min_capacity > 0 ? min_capacity : 1) - 1), slots(new slot[mask + 1]) {}
+
+	bounded_queue_spsc(const bounded_queue_spsc& other) = delete;
+	bounded_queue_spsc& operator=(const bounded_queue_spsc& other) = delete;
+
+	~bounded_queue_spsc()
+	{
+		for (std::size_t h = head.load(); h != tail.load(); ++h)
+		{
+			slots[h & mask].get()->~T();
+		}
+	}
+
+	std::size_t capacity() const
+	{
+		return mask + 1;
+	}
+
+	// only a snapshot, may be outdated as soon as it's returned
+	std::size_t size_approx() const
+	{
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		return t >= h ? t - h : 0;
+	}
+
+	// producer only. Returns false if the queue is full
+	template <typename... Args>
+	bool try_emplace(Args&&... args)
+	{
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		if (free_slots(t, 1) == 0)
+		{
+			return false;
+		}
+		new (slots[t & mask].storage) T(std::forward<Args>(args)...);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_push(T val)
+	{
+		return try_emplace(std::move(val));
+	}
+
+	// producer only. Moves as many of the n elements starting at first as fit and returns how many that were
+	template <typename InputIt>
+	std::size_t try_push_bulk(InputIt first, std::size_t n)
+	{
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		const std::size_t count = std::min(n, free_slots(t, n));
+		for (std::size_t i = 0; i < count; ++i, ++first)
+		{
+			new (slots[(t + i) & mask].storage) T(std::move(*first));
+		}
+		if (count > 0)
+		{
+			tail.store(t + count, std::memory_order_release);
+		}
+		return count;
+	}
+
+	// consumer only
+	bool try_pop(T& out_val)
+	{
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		if (available(h, 1) == 0)
+		{
+			return false;
+		}
+		T* elem = slots[h & mask].get();
+		out_val = std::move(*elem);
+		elem->~T();
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	std::optional<T> try_pop()
+	{
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		if (available(h, 1) == 0)
+		{
+			return std::nullopt;
+		}
+		T* elem = slots[h & mask].get();
+		std::optional<T> res(std::move(*elem));
+		elem->~T();
+		head.store(h + 1, std::memory_order_release);
+		return res;
+	}
+
+	// consumer only. Moves up to max_n elements into out and returns how many were popped
+	template <typename OutputIt>
+	std::size_t try_pop_bulk(OutputIt out, std::size_t max_n)
+	{
+		const std::size_t h = head.load(std::memory_order_relaxed);
+		const std::size_t count = std::min(max_n, available(h, max_n));
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			T* elem = slots[(h + i) & mask].get();
+			*out++ = std::move(*elem);
+			elem->~T();
+		}
+		if (count > 0)
+		{
+			head.store(h + count, std::memory_order_release);
+		}
+		return count;
+	}
+};
@@ -4,6 +4,8 @@
 #include <string>
 #include <iostream>
 
+// for a lighter weight one-time signal without the mutex round trip, see event.h
+
 std::mutex mut;
 bool ready = false;
 std::string data = "";
@@ -30,7 +32,8 @@ void producer()
 {
 	data = "some data";
 	{
-		std::scoped_lock(mut);
+		std::scoped_lock lock(mut);	// needs a name! "std::scoped_lock(mut);" declares a new, empty
+									// scoped_lock called mut and never locks the mutex.
 		ready = true;
 	}
 	cond_var.notify_one();
@@ -0,0 +1,19 @@
+#pragma once
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+// hint to the cpu that we are in a spin-wait loop. On x86 this is the "pause" instruction,
+// which keeps the spinning core from flooding the memory bus with speculative loads and
+// gives the other hyperthread on the same core a chance to make progress.
+inline void cpu_relax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+	Epoch based memory reclamation for lock free data structures.
+
+	lock_free_stack_fixed.h frees nodes when only one thread is inside pop. Under constant load that never
+	happens and the to_be_deleted list grows forever. Epochs fix that:
+
+	There is a global epoch counter. A thread that wants to read nodes of a lock free structure creates an
+	epoch_reclamation::guard, which announces "I'm reading, and the global epoch was e when I started".
+	A node that has been unlinked from the structure isn't deleted right away, but retired together with
+	the current global epoch. The global epoch can only move from e to e + 1 once every thread inside a
+	guard has announced e. So once the global epoch has moved two steps past the epoch a node was retired
+	in, every thread that might still have seen the node has left its guard, and it can be deleted.
+
+	Readers never wait for anyone (entering and leaving a guard are two stores), but a thread that sleeps
+	inside a guard holds back reclamation for everybody.
+
+	example usage:
+	{
+		epoch_reclamation::guard g;
+		node* old_head = head.load();
+		while (old_head && !head.compare_exchange_weak(old_head, old_head->next)) { ; }
+		if (old_head)
+			epoch_reclamation::retire(old_head); // deleted once no guard can still see it
+	}
+*/
+
+class epoch_reclamation
+{
+private:
+
+	struct retired_ptr
+	{
+		void* ptr;
+		void (*deleter)(void*);
+		std::uint64_t epoch;
+	};
+
+	// one per thread. Records are never freed, a thread that exits hands its record to the next thread
+	struct alignas(64) thread_record
+	{
+		std::atomic<std::uint64_t> epoch{ 0 }; // 0 = not inside a guard
+		std::atomic<bool> in_use{ true };
+		thread_record* next = nullptr;
+
+		// only touched by the owning thread
+		unsigned nesting = 0;
+		unsigned retires_since_collect = 0;
+		std::vector<retired_ptr> retired;
+	};
+
+	struct record_holder
+	{
+		thread_record* const record = acquire_record();
+		~record_holder() { record->in_use.store(false, std::memory_order_release); }
+	};
+
+	static constexpr unsigned collect_threshold = 64;
+
+	inline static std::atomic<std::uint64_t> global_epoch{ 1 };
+	inline static std::atomic<thread_record*> records{ nullptr };
+
+	static thread_record* acquire_record()
+	{
+		for (thread_record* r = records.load(std::memory_order_acquire); r; r = r->next)
+		{
+			bool expected = false;
+			if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			{
+				return r;
+			}
+		}
+		thread_record* r = new thread_record();
+		r->next = records.load(std::memory_order_relaxed);
+		while (!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) { ; }
+		return r;
+	}
+
+	static thread_record& local_record()
+	{
+		thread_local record_holder holder;
+		return *holder.record;
+	}
+
+	static void enter()
+	{
+		thread_record& r = local_record();
+		if (r.nesting++ == 0)
+		{
+			r.epoch.store(global_epoch.load());
+			std::atomic_thread_fence(std::memory_order_seq_cst); // the announcement must be visible before we read any node
+		}
+	}
+
+	static void leave()
+	{
+		thread_record& r = local_record();
+		if (--r.nesting == 0)
+		{
+			r.epoch.store(0, std::memory_order_release);
+		}
+	}
+
+	static void try_advance()
+	{
+		std::uint64_t current = global_epoch.load();
+		for (thread_record* r = records.load(std::memory_order_acquire); r; r = r->next)
+		{
+			std::uint64_t e = r->epoch.load();
+			if (e != 0 && e != current)
+			{
+				return; // someone is still reading in an older epoch
+			}
+		}
+		global_epoch.compare_exchange_strong(current, current + 1);
+	}
+
+	static void collect(thread_record& r)
+	{
+		const std::uint64_t current = global_epoch.load();
+		auto still_visible = [current](const retired_ptr& p) { return p.epoch + 2 > current; };
+		auto first_free = std::partition(r.retired.begin(), r.retired.end(), still_visible);
+		for (auto it = first_free; it != r.retired.end(); ++it)
+		{
+			it->deleter(it->ptr);
+		}
+		r.retired.erase(first_free, r.retired.end());
+	}
+
+public:
+
+	class guard
+	{
+	public:
+		guard() { enter(); }
+		~guard() { leave(); }
+		guard(const guard& other) = delete;
+		guard& operator=(const guard& other) = delete;
+	};
+
+	// p must already be unreachable for threads that start reading from now on
+	static void retire(void* p, void (*deleter)(void*))
+	{
+		thread_record& r = local_record();
+		r.retired.push_back(retired_ptr{ p, deleter, global_epoch.load() });
+		if (++r.retires_since_collect >= collect_threshold)
+		{
+			r.retires_since_collect = 0;
+			try_advance();
+			collect(r);
+		}
+	}
+
+	template <typename T>
+	static void retire(T* p)
+	{
+		retire(p, [](void* q) { delete static_cast<T*>(q); });
+	}
+};
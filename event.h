@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "cpu_relax.h"
+
+/*
+	One-shot event built on a single 32 bit atomic word, as a lighter replacement for the
+	mutex + bool ready + condition_variable handshake in condition_variable.h.
+
+	std::atomic::wait/notify map onto the OS futex (WaitOnAddress on Windows, futex on Linux),
+	so a sleeping thread costs nothing while it waits. But notify is a system call even if
+	nobody is sleeping. That's why the word also records whether anyone went to sleep:
+
+		unset			nobody has called set() yet, nobody is sleeping
+		unset_waiting	nobody has called set() yet, at least one thread is (about to be) sleeping
+		is_set			set() has been called
+
+	set() with no waiters is a single exchange and never enters the kernel.
+
+	example usage:
+	event ready;
+	std::string data;
+	std::thread t0([&] { ready.wait(); std::cout << data; }); // prints "some data"
+	data = "some data";
+	ready.set();
+	t0.join();
+*/
+
+class event
+{
+	static constexpr std::uint32_t unset = 0;
+	static constexpr std::uint32_t unset_waiting = 1;
+	static constexpr std::uint32_t is_set = 2;
+
+	static constexpr int spin_count = 100;
+
+	std::atomic<std::uint32_t> state{ unset };
+
+public:
+
+	event() = default;
+	event(const event& other) = delete;
+	event& operator=(const event& other) = delete;
+
+	void set()
+	{
+		// release: everything written before set() is visible to whoever returns from wait()
+		if (state.exchange(is_set, std::memory_order_release) == unset_waiting)
+		{
+			state.notify_all();
+		}
+	}
+
+	bool is_signaled() const
+	{
+		return state.load(std::memory_order_acquire) == is_set;
+	}
+
+	void wait()
+	{
+		// most of the time the event is set shortly after, so spin a little before going to sleep
+		for (int i = 0; i < spin_count; ++i)
+		{
+			if (is_signaled())
+			{
+				return;
+			}
+			cpu_relax();
+		}
+
+		std::uint32_t expected = unset;
+		// announce that we are going to sleep. If this fails, expected is either unset_waiting
+		// (someone else announced it already) or is_set (we're done).
+		state.compare_exchange_strong(expected, unset_waiting, std::memory_order_acquire);
+		while (state.load(std::memory_order_acquire) != is_set)
+		{
+			state.wait(unset_waiting, std::memory_order_acquire); // returns immediately if the value has changed in the meantime
+		}
+	}
+
+	// only allowed while no thread is inside wait()
+	void reset()
+	{
+		state.store(unset, std::memory_order_relaxed);
+	}
+};
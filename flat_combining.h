@@ -0,0 +1,193 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cpu_relax.h"
+#include "spinlock_mutex.h"
+#include "this_thread.h"
+
+/*
+	Flat combining: wraps any sequential container and makes it threadsafe.
+
+	With a plain mutex, every thread that wants to access the container pulls the lock's cache
+	line and the container's cache lines over to its own core, one after the other. Here, a thread
+	instead publishes its operation in a publication slot and tries to grab the lock. Whoever
+	holds the lock (the "combiner") runs all pending operations of all threads in one batch
+	while the container is hot in its cache. The other threads just spin on their own request
+	until the combiner marks it as done.
+
+	Slots are not owned by a thread. A thread starts at "its" slot (derived from a per thread index)
+	and probes forward if that one is currently occupied, so any number of threads is fine.
+
+	example usage:
+	flat_combining<std::queue<int>> queue;
+	queue.apply([](std::queue<int>& q) { q.push(42); });
+	std::optional<int> front = queue.apply([](std::queue<int>& q) -> std::optional<int>
+	{
+		if (q.empty())
+			return std::nullopt;
+		int res = q.front();
+		q.pop();
+		return res;
+	});
+
+	See flat_combining_benchmark.h for a comparison with threadsafe_queue.
+*/
+
+template <typename Container>
+class flat_combining
+{
+private:
+
+	struct request
+	{
+		void (*run)(request* self, Container& container);
+		std::exception_ptr exception;
+		std::atomic<bool> done{ false };
+	};
+
+	template <typename Op, typename Result>
+	struct typed_request : request
+	{
+		Op& op;
+		std::optional<Result> result;
+
+		explicit typed_request(Op& op_) : op(op_) { this->run = &typed_request::execute; }
+
+		static void execute(request* self, Container& container)
+		{
+			auto* me = static_cast<typed_request*>(self);
+			me->result.emplace(std::invoke(me->op, container));
+		}
+	};
+
+	template <typename Op>
+	struct typed_request<Op, void> : request
+	{
+		Op& op;
+
+		explicit typed_request(Op& op_) : op(op_) { this->run = &typed_request::execute; }
+
+		static void execute(request* self, Container& container)
+		{
+			std::invoke(static_cast<typed_request*>(self)->op, container);
+		}
+	};
+
+	// one cache line per slot, otherwise publishing threads would false share with each other
+	struct alignas(64) slot
+	{
+		std::atomic<request*> pending{ nullptr };
+	};
+
+	static constexpr int spins_before_retry = 64;
+	static constexpr int max_combining_passes = 3;
+
+	Container container;
+	spinlock_mutex combiner_lock;
+	std::vector<slot> slots;
+
+	std::size_t publish(request* req)
+	{
+		std::size_t i = this_thread_index() % slots.size();
+		while (true)
+		{
+			request* expected = nullptr;
+			// release: the combiner has to see the fully constructed request
+			if (slots[i].pending.compare_exchange_weak(expected, req, std::memory_order_release, std::memory_order_relaxed))
+			{
+				return i;
+			}
+			i = (i + 1) % slots.size();
+			cpu_relax();
+		}
+	}
+
+	void combine()
+	{
+		for (int pass = 0; pass < max_combining_passes; ++pass)
+		{
+			bool found_any = false;
+			for (slot& s : slots)
+			{
+				request* req = s.pending.load(std::memory_order_acquire);
+				if (!req)
+				{
+					continue;
+				}
+				found_any = true;
+				try
+				{
+					req->run(req, container);
+				}
+				catch (...)
+				{
+					req->exception = std::current_exception();
+				}
+				// free the slot before signaling, the owner may reuse it as soon as it sees done.
+				// After done is set, req may already be gone, don't touch it anymore!
+				s.pending.store(nullptr, std::memory_order_relaxed);
+				req->done.store(true, std::memory_order_release);
+			}
+			if (!found_any)
+			{
+				return;
+			}
+		}
+	}
+
+	void execute(request& req)
+	{
+		publish(&req);
+		while (true)
+		{
+			if (combiner_lock.try_lock())
+			{
+				combine(); // our own request was published before taking the lock, so it's handled in here
+				combiner_lock.unlock();
+			}
+			for (int i = 0; i < spins_before_retry; ++i)
+			{
+				if (req.done.load(std::memory_order_acquire))
+				{
+					if (req.exception)
+					{
+						std::rethrow_exception(req.exception);
+					}
+					return;
+				}
+				cpu_relax();
+			}
+			std::this_thread::yield();
+		}
+	}
+
+public:
+
+	template <typename... Args>
+	explicit flat_combining(std::size_t num_slots = 64, Args&&... args)
+		: container(std::forward<Args>(args)...), slots(num_slots > 0 ? num_slots : 1) {}
+
+	flat_combining(const flat_combining& other) = delete;
+	flat_combining& operator=(const flat_combining& other) = delete;
+
+	// runs op(container) under mutual exclusion, possibly on another thread, and returns its result.
+	// op must not call apply on the same flat_combining object.
+	template <typename Op>
+	auto apply(Op op) -> std::invoke_result_t<Op&, Container&>
+	{
+		using result_type = std::invoke_result_t<Op&, Container&>;
+		typed_request<Op, result_type> req(op);
+		execute(req);
+		if constexpr (!std::is_void_v<result_type>)
+		{
+			return std::move(*req.result);
+		}
+	}
+};
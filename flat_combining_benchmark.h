@@ -0,0 +1,68 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "flat_combining.h"
+#include "latch.h"
+#include "threadsafe_queue.h"
+
+/*
+	Every thread does ops_per_thread push/pop pairs on one shared queue, once on threadsafe_queue
+	(two locks, one allocation per push) and once on flat_combining<std::queue<int>>.
+	Prints the wall clock time of both runs. Call from main, e.g. benchmark_flat_combining(32);
+*/
+
+template <typename Work>
+double run_threads_timed(unsigned num_threads, Work work)
+{
+	latch start(num_threads + 1);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < num_threads; ++i)
+	{
+		threads.emplace_back([&] { start.arrive_and_wait(); work(); });
+	}
+	auto begin = std::chrono::steady_clock::now();
+	start.count_down();
+	for (std::thread& t : threads)
+	{
+		t.join();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+inline void benchmark_flat_combining(unsigned num_threads = 32, int ops_per_thread = 100000)
+{
+	threadsafe_queue<int> two_lock_queue;
+	double two_lock_ms = run_threads_timed(num_threads, [&]
+	{
+		for (int i = 0; i < ops_per_thread; ++i)
+		{
+			two_lock_queue.push(i);
+			two_lock_queue.try_pop();
+		}
+	});
+
+	flat_combining<std::queue<int>> combined_queue;
+	double combined_ms = run_threads_timed(num_threads, [&]
+	{
+		for (int i = 0; i < ops_per_thread; ++i)
+		{
+			combined_queue.apply([i](std::queue<int>& q) { q.push(i); });
+			combined_queue.apply([](std::queue<int>& q) -> std::optional<int>
+			{
+				if (q.empty())
+					return std::nullopt;
+				int res = q.front();
+				q.pop();
+				return res;
+			});
+		}
+	});
+
+	std::cout << num_threads << " threads, " << ops_per_thread << " push/pop pairs each\n";
+	std::cout << "threadsafe_queue:              " << two_lock_ms << " ms\n";
+	std::cout << "flat_combining<std::queue>:    " << combined_ms << " ms\n";
+}
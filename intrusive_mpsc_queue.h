@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+
+/*
+	Intrusive multi producer single consumer queue (after Dmitry Vyukov), for mailboxes and loggers.
+
+	"Intrusive" means the queue doesn't allocate nodes, the link lives inside the caller's objects:
+
+	struct log_message : intrusive_mpsc_hook
+	{
+		std::string text;
+	};
+
+	push is a single exchange on back plus a store, no loop, no lock, so it's wait free: every producer
+	finishes in a bounded number of steps no matter what the other threads do.
+
+	The catch: between the exchange and the store of the link, the new element is already the back of
+	the queue but not reachable from the front yet. If a producer is preempted right there, the consumer
+	can't get past that point and try_pop reports empty until the producer continues, even if
+	elements behind it were pushed later.
+
+	The queue never owns the elements. They must stay alive while they're in the queue, and an element
+	can only be in one queue at a time.
+
+	example usage:
+	intrusive_mpsc_queue<log_message> mailbox;
+	// any number of producers:
+	mailbox.push(new log_message{ {}, "hello" });
+	// exactly one consumer:
+	mailbox.consume_all([](log_message* msg) { std::cout << msg->text << '\n'; delete msg; });
+*/
+
+struct intrusive_mpsc_hook
+{
+	std::atomic<intrusive_mpsc_hook*> mpsc_next{ nullptr };
+};
+
+template <typename T>
+class intrusive_mpsc_queue
+{
+	static_assert(std::is_base_of<intrusive_mpsc_hook, T>::value, "T has to derive from intrusive_mpsc_hook");
+
+private:
+
+	// producers only touch back, the consumer mostly only touches front, keep them on separate cache lines
+	alignas(64) std::atomic<intrusive_mpsc_hook*> back;
+	alignas(64) intrusive_mpsc_hook* front;
+	intrusive_mpsc_hook stub; // dummy, so that the queue is never really empty
+
+	void push_hook(intrusive_mpsc_hook* h)
+	{
+		h->mpsc_next.store(nullptr, std::memory_order_relaxed);
+		intrusive_mpsc_hook* prev = back.exchange(h, std::memory_order_acq_rel);
+		prev->mpsc_next.store(h, std::memory_order_release); // from here on, the consumer can reach h
+	}
+
+public:
+
+	intrusive_mpsc_queue() : back(&stub), front(&stub) {}
+
+	intrusive_mpsc_queue(const intrusive_mpsc_queue& other) = delete;
+	intrusive_mpsc_queue& operator=(const intrusive_mpsc_queue& other) = delete;
+
+	// any thread
+	void push(T* element)
+	{
+		push_hook(element);
+	}
+
+	// consumer thread only. Returns nullptr if the queue is empty (or a producer is in the middle of a push)
+	T* try_pop()
+	{
+		intrusive_mpsc_hook* first = front;
+		intrusive_mpsc_hook* next = first->mpsc_next.load(std::memory_order_acquire);
+		if (first == &stub)
+		{
+			if (!next)
+			{
+				return nullptr;
+			}
+			front = next; // skip the stub
+			first = next;
+			next = next->mpsc_next.load(std::memory_order_acquire);
+		}
+		if (next)
+		{
+			front = next;
+			return static_cast<T*>(first);
+		}
+
+		// first is the last linked element. We can only hand it out if it has a successor, so push the stub behind it
+		if (first != back.load(std::memory_order_acquire))
+		{
+			return nullptr; // a producer has exchanged back, but not linked its element yet
+		}
+		push_hook(&stub);
+		next = first->mpsc_next.load(std::memory_order_acquire);
+		if (next)
+		{
+			front = next;
+			return static_cast<T*>(first);
+		}
+		return nullptr; // a producer got in between, its element will be linked behind first shortly
+	}
+
+	// consumer thread only. Calls fn(T*) for up to max_n elements and returns how many were consumed.
+	// After fn returns, the queue doesn't touch the element anymore, so fn may delete or reuse it.
+	template <typename Fn>
+	std::size_t consume_all(Fn fn, std::size_t max_n = std::numeric_limits<std::size_t>::max())
+	{
+		std::size_t count = 0;
+		while (count < max_n)
+		{
+			T* element = try_pop();
+			if (!element)
+			{
+				break;
+			}
+			fn(element);
+			++count;
+		}
+		return count;
+	}
+
+	// consumer thread only, just a hint if producers are active
+	bool empty() const
+	{
+		return front == &stub && !stub.mpsc_next.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include "cpu_relax.h"
+
+/*
+	Single use countdown latch on one 32 bit atomic word (like std::latch).
+	The lower 31 bits hold the count, the highest bit is set once a thread goes to sleep
+	in wait(), so the last count_down() only calls notify if someone actually sleeps.
+
+	example usage:
+	latch done(4);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < 4; ++i)
+	{
+		workers.emplace_back([&] { do_work(); done.count_down(); });
+	}
+	done.wait(); // returns once all 4 workers called count_down()
+*/
+
+class latch
+{
+	static constexpr std::uint32_t waiters_bit = 1u << 31;
+	static constexpr std::uint32_t count_mask = waiters_bit - 1;
+
+	static constexpr int spin_count = 100;
+
+	std::atomic<std::uint32_t> counter;
+
+public:
+
+	explicit latch(std::uint32_t expected) : counter(expected)
+	{
+		assert(expected <= count_mask);
+	}
+
+	latch(const latch& other) = delete;
+	latch& operator=(const latch& other) = delete;
+
+	void count_down(std::uint32_t n = 1)
+	{
+		std::uint32_t old = counter.fetch_sub(n, std::memory_order_acq_rel);
+		assert((old & count_mask) >= n); // counted down more often than expected
+		if (old - n == waiters_bit) // count hit zero and somebody is sleeping
+		{
+			counter.notify_all();
+		}
+	}
+
+	bool try_wait() const
+	{
+		return (counter.load(std::memory_order_acquire) & count_mask) == 0;
+	}
+
+	void wait()
+	{
+		for (int i = 0; i < spin_count; ++i)
+		{
+			if (try_wait())
+			{
+				return;
+			}
+			cpu_relax();
+		}
+
+		// after setting the bit, whoever brings the count to zero is guaranteed to see it
+		std::uint32_t current = counter.fetch_or(waiters_bit, std::memory_order_acquire) | waiters_bit;
+		while ((current & count_mask) != 0)
+		{
+			counter.wait(current, std::memory_order_acquire);
+			current = counter.load(std::memory_order_acquire);
+		}
+	}
+
+	void arrive_and_wait(std::uint32_t n = 1)
+	{
+		count_down(n);
+		wait();
+	}
+};
@@ -0,0 +1,374 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include "epoch_reclamation.h"
+#include "marked_pointer.h"
+
+/*
+	Lock free hash table with the same interface as threadsafe_lut (split ordered list, after Shalev & Shavit).
+
+	threadsafe_lut has a fixed vector of buckets with one shared_mutex each. Writers to the same bucket
+	wait for each other, and the bucket vector can't grow without locking everything.
+
+	Here, all entries live in one sorted lock free linked list. The trick is the sort order: entries are
+	sorted by their hash with the bits reversed. Then every bucket (hash % size, with size a power of two)
+	is a contiguous piece of the list, and if the table doubles, bucket b splits into b and b + size
+	exactly between existing nodes. So a bucket is just a pointer to a dummy node ("sentinel") in the
+	list, where that bucket's piece starts. Growing the table only means doubling size; the sentinels of
+	the new buckets are inserted lazily the first time somebody uses the bucket. Nodes never move.
+
+	To tell sentinels and entries apart, entries have the lowest bit of their sort key set, sentinels don't.
+
+	Removing an entry marks its next pointer first (logical delete) and then unlinks it (physical delete),
+	any thread walking over a marked node helps unlinking it. Whoever unlinks a node retires it to
+	epoch_reclamation. Updating a value swaps in a new value object and retires the old one, so readers
+	can always copy the value they loaded.
+
+	example usage: same as threadsafe_lut, e.g.
+	lock_free_lut<int, std::string> lut;
+	std::thread t0(&lock_free_lut<int, std::string>::add_or_update_mapping, &lut, 6, "six");
+	std::thread t1(&lock_free_lut<int, std::string>::remove_mapping, &lut, 6);
+*/
+
+template<typename KeyType, typename ValueType>
+class lock_free_lut
+{
+	static_assert(std::is_default_constructible<std::hash<KeyType>>::value); // assert that KeyType is hashable
+
+private:
+
+	struct node
+	{
+		const std::size_t so_key; // split order key, bit reversed hash
+		std::atomic<node*> next{ nullptr };
+		explicit node(std::size_t so_key_) : so_key(so_key_) {}
+
+		bool is_sentinel() const { return (so_key & 1) == 0; }
+	};
+
+	struct entry : node
+	{
+		const KeyType key;
+		std::atomic<ValueType*> value;
+		entry(std::size_t so_key_, KeyType key_, ValueType* value_) : node(so_key_), key(std::move(key_)), value(value_) {}
+		~entry() { delete value.load(std::memory_order_relaxed); }
+	};
+
+	static constexpr std::size_t max_load_factor = 2;
+	static constexpr std::size_t msb = std::size_t(1) << (sizeof(std::size_t) * 8 - 1);
+	static constexpr int num_segments = sizeof(std::size_t) * 8;
+
+	// bucket b lives in segment bit_width(b): segment 0 holds bucket 0, segment s > 0 holds buckets [2^(s-1), 2^s).
+	// Segments are allocated when first needed and never move, so bucket pointers stay valid while the table grows.
+	std::atomic<std::atomic<node*>*> segments[num_segments];
+	std::atomic<std::size_t> size;	// number of buckets in use, always a power of two
+	std::atomic<std::size_t> count{ 0 };
+
+	static std::size_t reverse_bits(std::size_t x)
+	{
+		// swap neighboring bits, then pairs, then nibbles (all / 3 = 0x55..., all / 5 = 0x33..., all / 17 = 0x0f...) ...
+		constexpr std::size_t all = ~std::size_t(0);
+		x = ((x >> 1) & (all / 3)) | ((x & (all / 3)) << 1);
+		x = ((x >> 2) & (all / 5)) | ((x & (all / 5)) << 2);
+		x = ((x >> 4) & (all / 17)) | ((x & (all / 17)) << 4);
+		// ... then reverse the byte order
+		std::size_t res = 0;
+		for (std::size_t i = 0; i < sizeof(std::size_t); ++i)
+		{
+			res = (res << 8) | (x & 0xff);
+			x >>= 8;
+		}
+		return res;
+	}
+
+	static std::size_t hash(const KeyType& key)
+	{
+		return std::hash<KeyType>{}(key) & ~msb; // the top bit becomes the "is an entry" bit after reversing
+	}
+
+	static std::size_t entry_so_key(std::size_t h) { return reverse_bits(h) | 1; }
+	static std::size_t sentinel_so_key(std::size_t bucket) { return reverse_bits(bucket); }
+
+	static void destroy_node(void* p)
+	{
+		node* n = static_cast<node*>(p);
+		if (n->is_sentinel())
+		{
+			delete n;
+		}
+		else
+		{
+			delete static_cast<entry*>(n);
+		}
+	}
+
+	std::atomic<node*>& bucket_slot(std::size_t bucket)
+	{
+		const int s = std::bit_width(bucket);
+		const std::size_t segment_size = s == 0 ? 1 : std::size_t(1) << (s - 1);
+		const std::size_t offset = s == 0 ? 0 : bucket - segment_size;
+		std::atomic<node*>* segment = segments[s].load(std::memory_order_acquire);
+		if (!segment)
+		{
+			std::atomic<node*>* fresh = new std::atomic<node*>[segment_size]();
+			if (segments[s].compare_exchange_strong(segment, fresh, std::memory_order_acq_rel))
+			{
+				segment = fresh;
+			}
+			else
+			{
+				delete[] fresh; // another thread was faster, segment now holds its allocation
+			}
+		}
+		return segment[offset];
+	}
+
+	struct position
+	{
+		std::atomic<node*>* prev;
+		node* curr;
+	};
+
+	// walks from start to the place of (so_key, key). If an entry with that key exists, curr points to it
+	// and true is returned. Otherwise curr is the first node that sorts after it. Unlinks marked nodes on the way.
+	// must be called inside an epoch guard
+	bool find(node* start, std::size_t so_key, const KeyType* key, position& pos)
+	{
+	retry:
+		pos.prev = &start->next;
+		pos.curr = pos.prev->load();
+		while (true)
+		{
+			if (is_marked(pos.curr))
+			{
+				goto retry; // the node before us got deleted
+			}
+			if (!pos.curr)
+			{
+				return false;
+			}
+			node* next = pos.curr->next.load();
+			if (is_marked(next))
+			{
+				// curr is deleted, unlink it. Only one thread can succeed here, that one retires it.
+				node* expected = pos.curr;
+				if (!pos.prev->compare_exchange_strong(expected, unmarked(next)))
+				{
+					goto retry;
+				}
+				epoch_reclamation::retire(pos.curr, &destroy_node);
+				pos.curr = unmarked(next);
+				continue;
+			}
+			if (pos.curr->so_key > so_key)
+			{
+				return false;
+			}
+			if (pos.curr->so_key == so_key && (!key || *key == static_cast<entry*>(pos.curr)->key))
+			{
+				return true; // several keys can share a hash, so only stop at the one that is really equal
+			}
+			pos.prev = &pos.curr->next;
+			pos.curr = next;
+		}
+	}
+
+	node* get_bucket(std::size_t bucket)
+	{
+		std::atomic<node*>& slot = bucket_slot(bucket);
+		node* sentinel = slot.load(std::memory_order_acquire);
+		if (!sentinel)
+		{
+			sentinel = initialize_bucket(bucket, slot);
+		}
+		return sentinel;
+	}
+
+	// inserts the sentinel for bucket into the list, starting from its parent bucket
+	// (the bucket it was split from, i.e. without its highest bit)
+	node* initialize_bucket(std::size_t bucket, std::atomic<node*>& slot)
+	{
+		node* parent = get_bucket(bucket & ~(std::size_t(1) << (std::bit_width(bucket) - 1)));
+		const std::size_t so_key = sentinel_so_key(bucket);
+		node* sentinel = new node(so_key);
+		position pos;
+		while (true)
+		{
+			if (find(parent, so_key, nullptr, pos))
+			{
+				delete sentinel; // another thread inserted it already, never published ours
+				sentinel = pos.curr;
+				break;
+			}
+			sentinel->next.store(pos.curr, std::memory_order_relaxed);
+			node* expected = pos.curr;
+			if (pos.prev->compare_exchange_strong(expected, sentinel))
+			{
+				break;
+			}
+		}
+		slot.store(sentinel, std::memory_order_release);
+		return sentinel;
+	}
+
+	node* bucket_for(std::size_t h)
+	{
+		return get_bucket(h & (size.load(std::memory_order_acquire) - 1));
+	}
+
+	void grow_if_needed(std::size_t new_count)
+	{
+		std::size_t current = size.load(std::memory_order_relaxed);
+		if (new_count / current > max_load_factor && current < msb)
+		{
+			size.compare_exchange_strong(current, current * 2); // if this fails, somebody else grew it
+		}
+	}
+
+public:
+
+	lock_free_lut(size_t num_buckets = 16) : size(std::bit_ceil(num_buckets > 0 ? num_buckets : 1))
+	{
+		for (auto& segment : segments)
+		{
+			segment.store(nullptr, std::memory_order_relaxed);
+		}
+		bucket_slot(0).store(new node(sentinel_so_key(0)), std::memory_order_relaxed); // head of the list
+	}
+
+	lock_free_lut(const lock_free_lut& other) = delete;
+	lock_free_lut& operator=(const lock_free_lut& other) = delete;
+
+	// no other thread may use the table anymore
+	~lock_free_lut()
+	{
+		node* n = bucket_slot(0).load();
+		while (n)
+		{
+			node* next = unmarked(n->next.load());
+			destroy_node(n);
+			n = next;
+		}
+		for (auto& segment : segments)
+		{
+			delete[] segment.load();
+		}
+	}
+
+	void add_or_update_mapping(KeyType key, ValueType val);
+
+	void remove_mapping(KeyType key);
+
+	std::shared_ptr<ValueType> value_for(KeyType key);
+
+	bool value_for(KeyType key, ValueType& out_val);
+};
+
+template<typename KeyType, typename ValueType>
+inline void lock_free_lut<KeyType, ValueType>::add_or_update_mapping(KeyType key, ValueType val)
+{
+	epoch_reclamation::guard g;
+	const std::size_t h = hash(key);
+	const std::size_t so_key = entry_so_key(h);
+	ValueType* new_value = new ValueType(std::move(val));
+	entry* new_entry = nullptr;
+	position pos;
+	while (true)
+	{
+		node* start = bucket_for(h);
+		const KeyType& k = new_entry ? new_entry->key : key; // key has been moved into new_entry after the first attempt
+		if (find(start, so_key, &k, pos)) // found entry with same key
+		{
+			entry* existing = static_cast<entry*>(pos.curr);
+			ValueType* old_value = existing->value.exchange(new_value);
+			epoch_reclamation::retire(old_value); // readers may still be copying it
+			if (is_marked(existing->next.load()))
+			{
+				// removed concurrently, maybe before our exchange. Treat the remove as first and insert again.
+				// new_value belongs to the dying entry now, so we need a fresh copy.
+				new_value = new ValueType(*new_value);
+				continue;
+			}
+			delete new_entry; // never published, its value pointer is still null
+			return;
+		}
+		if (!new_entry)
+		{
+			new_entry = new entry(so_key, std::move(key), nullptr);
+		}
+		new_entry->value.store(new_value, std::memory_order_relaxed);
+		new_entry->next.store(pos.curr, std::memory_order_relaxed);
+		node* expected = pos.curr;
+		if (pos.prev->compare_exchange_strong(expected, new_entry))
+		{
+			grow_if_needed(count.fetch_add(1, std::memory_order_relaxed) + 1);
+			return;
+		}
+		new_entry->value.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+template<typename KeyType, typename ValueType>
+inline void lock_free_lut<KeyType, ValueType>::remove_mapping(KeyType key)
+{
+	epoch_reclamation::guard g;
+	const std::size_t h = hash(key);
+	const std::size_t so_key = entry_so_key(h);
+	node* start = bucket_for(h);
+	position pos;
+	if (!find(start, so_key, &key, pos))
+	{
+		return;
+	}
+	node* victim = pos.curr;
+	node* next = victim->next.load();
+	do
+	{
+		if (is_marked(next))
+		{
+			return; // another thread removed it first
+		}
+	} while (!victim->next.compare_exchange_weak(next, marked(next)));
+	count.fetch_sub(1, std::memory_order_relaxed);
+
+	node* expected = victim;
+	if (pos.prev->compare_exchange_strong(expected, next))
+	{
+		epoch_reclamation::retire(victim, &destroy_node);
+	}
+	else
+	{
+		find(start, so_key, &key, pos); // let find unlink (and retire) it
+	}
+}
+
+template<typename KeyType, typename ValueType>
+inline std::shared_ptr<ValueType> lock_free_lut<KeyType, ValueType>::value_for(KeyType key)
+{
+	epoch_reclamation::guard g;
+	const std::size_t h = hash(key);
+	position pos;
+	if (!find(bucket_for(h), entry_so_key(h), &key, pos))
+	{
+		return nullptr;
+	}
+	return std::make_shared<ValueType>(*static_cast<entry*>(pos.curr)->value.load());
+}
+
+template<typename KeyType, typename ValueType>
+inline bool lock_free_lut<KeyType, ValueType>::value_for(KeyType key, ValueType& out_val)
+{
+	epoch_reclamation::guard g;
+	const std::size_t h = hash(key);
+	position pos;
+	if (!find(bucket_for(h), entry_so_key(h), &key, pos))
+	{
+		return false;
+	}
+	out_val = *static_cast<entry*>(pos.curr)->value.load();
+	return true;
+}
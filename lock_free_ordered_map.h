@@ -0,0 +1,373 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <optional>
+#include <utility>
+#include "epoch_reclamation.h"
+#include "marked_pointer.h"
+#include "this_thread.h"
+
+/*
+	Lock free ordered map (skip list, after Herlihy & Shavit / Fraser). Unlike threadsafe_lut it keeps
+	its keys sorted, so it can answer lower_bound and range queries.
+
+	Every node is in the bottom level list, and with probability 1/2 also in the level above, 1/4 in the
+	one above that, etc. Searching starts at the top level and drops down a level whenever the next key
+	would be too big, so it takes O(log n) steps.
+
+	Deleting a node happens in two steps:
+	1. logical deletion: the lowest bit of the node's next pointers is set ("marked"), from the top level
+	   down to level 0. Whoever marks level 0 has deleted the key.
+	2. physical deletion: find() unlinks every marked node it walks over. Any thread does this, not only
+	   the one that deleted the node.
+
+	A node is retired to epoch_reclamation once both its inserter is done linking it into the upper
+	levels and its deleter is done unlinking it (see node::refs), so no thread can link it back in after
+	it's gone. Readers are inside an epoch guard, so a node they are standing on is never freed under
+	their feet.
+
+	Values are never modified after insertion, so find and range_scan can copy them without a lock.
+
+	example usage:
+	lock_free_ordered_map<int, std::string> map;
+	map.insert(3, "three");
+	map.insert(1, "one");
+	map.insert(7, "seven");
+	map.range_scan(2, 8, [](const int& key, const std::string& value) { std::cout << key << ": " << value << '\n'; }); // prints 3 and 7
+	auto first = map.lower_bound(2); // {3, "three"}
+	map.erase(3);
+	auto smallest = map.try_pop_front(); // {1, "one"}, and 1 is gone from the map
+*/
+
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class lock_free_ordered_map
+{
+private:
+
+	static constexpr int max_level = 24;
+
+	// the links array of node "height" follows directly after the node in the same allocation
+	struct alignas(std::atomic<void*>) node
+	{
+		const Key key;
+		const Value value;
+		const int height;
+		std::atomic<int> refs{ 2 }; // one for the inserter, one for the deleter, the last one retires the node
+
+		template <typename K, typename V>
+		node(K&& key_, V&& value_, int height_) : key(std::forward<K>(key_)), value(std::forward<V>(value_)), height(height_) {}
+
+		std::atomic<node*>* links()
+		{
+			return reinterpret_cast<std::atomic<node*>*>(this + 1);
+		}
+	};
+
+	std::atomic<node*> head[max_level]; // a "node" without key that's smaller than everything
+	Compare comp;
+
+	template <typename K, typename V>
+	static node* create_node(K&& key, V&& value, int height)
+	{
+		void* mem = ::operator new(sizeof(node) + height * sizeof(std::atomic<node*>));
+		node* n = new (mem) node(std::forward<K>(key), std::forward<V>(value), height);
+		for (int level = 0; level < height; ++level)
+		{
+			new (&n->links()[level]) std::atomic<node*>(nullptr);
+		}
+		return n;
+	}
+
+	static void destroy_node(void* p)
+	{
+		node* n = static_cast<node*>(p);
+		n->~node(); // the links are trivially destructible
+		::operator delete(n);
+	}
+
+	static void release(node* n)
+	{
+		if (n->refs.fetch_sub(1) == 1)
+		{
+			epoch_reclamation::retire(n, &destroy_node);
+		}
+	}
+
+	static int random_height()
+	{
+		const std::uint64_t bits = this_thread_random();
+		int height = 1;
+		while ((bits >> height & 1) && height < max_level)
+		{
+			++height;
+		}
+		return height;
+	}
+
+	// nullptr is the end of every level, and bigger than every key
+	bool less_than(node* n, const Key& key) const
+	{
+		return n && comp(n->key, key);
+	}
+
+	bool equals(node* n, const Key& key) const
+	{
+		return n && !comp(n->key, key) && !comp(key, n->key);
+	}
+
+	// fills preds[level] with the link that points to the first node >= key on each level, and
+	// succs[level] with that node. Unlinks all marked nodes on the way. Returns true if succs[0] has key.
+	// must be called inside an epoch guard
+	bool find(const Key& key, std::atomic<node*>** preds, node** succs)
+	{
+	retry:
+		std::atomic<node*>* pred = head;
+		for (int level = max_level - 1; level >= 0; --level)
+		{
+			node* curr = pred[level].load();
+			while (true)
+			{
+				if (is_marked(curr))
+				{
+					goto retry; // pred itself got deleted in the meantime
+				}
+				if (!curr)
+				{
+					break;
+				}
+				node* succ = curr->links()[level].load();
+				while (is_marked(succ))
+				{
+					// curr is deleted, unlink it on this level
+					if (!pred[level].compare_exchange_strong(curr, unmarked(succ)))
+					{
+						goto retry;
+					}
+					curr = unmarked(succ);
+					if (!curr)
+					{
+						break;
+					}
+					succ = curr->links()[level].load();
+				}
+				if (!less_than(curr, key))
+				{
+					break;
+				}
+				pred = curr->links();
+				curr = succ;
+			}
+			preds[level] = &pred[level];
+			succs[level] = curr;
+		}
+		return equals(succs[0], key);
+	}
+
+	// logically deletes n, marking its links from the top level down.
+	// Returns false if another thread marked level 0 first, i.e. deleted it.
+	bool mark_deleted(node* n)
+	{
+		for (int level = n->height - 1; level > 0; --level)
+		{
+			node* succ = n->links()[level].load();
+			while (!is_marked(succ) && !n->links()[level].compare_exchange_weak(succ, marked(succ))) { ; }
+		}
+		node* succ = n->links()[0].load();
+		while (!is_marked(succ))
+		{
+			if (n->links()[0].compare_exchange_weak(succ, marked(succ))) // linearization point
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+
+	lock_free_ordered_map(Compare comp_ = Compare()) : comp(std::move(comp_))
+	{
+		for (std::atomic<node*>& link : head)
+		{
+			link.store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	lock_free_ordered_map(const lock_free_ordered_map& other) = delete;
+	lock_free_ordered_map& operator=(const lock_free_ordered_map& other) = delete;
+
+	// no other thread may use the map anymore
+	~lock_free_ordered_map()
+	{
+		node* n = unmarked(head[0].load());
+		while (n)
+		{
+			node* next = unmarked(n->links()[0].load());
+			destroy_node(n);
+			n = next;
+		}
+	}
+
+	// returns false (and leaves the existing value alone) if the key already exists
+	bool insert(Key key, Value value)
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		node* n = nullptr;
+		while (true)
+		{
+			if (find(n ? n->key : key, preds, succs)) // key has been moved into n after the first attempt
+			{
+				if (n)
+				{
+					destroy_node(n); // never published, nobody else has seen it
+				}
+				return false;
+			}
+			if (!n)
+			{
+				n = create_node(std::move(key), std::move(value), random_height());
+			}
+			for (int level = 0; level < n->height; ++level)
+			{
+				n->links()[level].store(succs[level], std::memory_order_relaxed);
+			}
+			node* expected = succs[0];
+			if (preds[0]->compare_exchange_strong(expected, n)) // linearization point
+			{
+				break;
+			}
+		}
+
+		// the key is in the map now, the upper levels are only shortcuts
+		for (int level = 1; level < n->height; ++level)
+		{
+			while (true)
+			{
+				node* expected = succs[level];
+				if (preds[level]->compare_exchange_strong(expected, n))
+				{
+					break;
+				}
+				find(n->key, preds, succs);
+				if (succs[0] != n)
+				{
+					goto done; // n got deleted already
+				}
+				// point n at its new successor, unless a deleter marked the link in the meantime
+				node* old_succ = n->links()[level].load();
+				if (is_marked(old_succ) || !n->links()[level].compare_exchange_strong(old_succ, succs[level]))
+				{
+					goto done;
+				}
+			}
+		}
+	done:
+		if (is_marked(n->links()[0].load()))
+		{
+			// a deleter may have finished unlinking before we linked n on some level, unlink it again
+			find(n->key, preds, succs);
+		}
+		release(n);
+		return true;
+	}
+
+	// returns true if the key was in the map
+	bool erase(const Key& key)
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		if (!find(key, preds, succs))
+		{
+			return false;
+		}
+		node* victim = succs[0];
+		if (!mark_deleted(victim))
+		{
+			return false;
+		}
+		find(key, preds, succs); // unlink it on all levels
+		release(victim);
+		return true;
+	}
+
+	// removes the entry with the smallest key and returns it, or nothing if the map is empty.
+	// Threads popping at the same time all race for the first node, but the loser just moves on to
+	// the next one, nobody waits for a lock.
+	std::optional<std::pair<Key, Value>> try_pop_front()
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		node* victim = unmarked(head[0].load());
+		while (victim)
+		{
+			if (mark_deleted(victim))
+			{
+				std::pair<Key, Value> res(victim->key, victim->value);
+				find(victim->key, preds, succs); // unlink it on all levels
+				release(victim);
+				return res;
+			}
+			victim = unmarked(victim->links()[0].load()); // already deleted by someone else, try the next one
+		}
+		return std::nullopt;
+	}
+
+	std::optional<Value> find(const Key& key)
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		if (!find(key, preds, succs))
+		{
+			return std::nullopt;
+		}
+		return succs[0]->value;
+	}
+
+	bool contains(const Key& key)
+	{
+		return find(key).has_value();
+	}
+
+	// first entry with a key that is not less than key
+	std::optional<std::pair<Key, Value>> lower_bound(const Key& key)
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		find(key, preds, succs);
+		if (!succs[0])
+		{
+			return std::nullopt;
+		}
+		return std::make_pair(succs[0]->key, succs[0]->value);
+	}
+
+	// calls fn(key, value) for the entries with lo <= key < hi, in order.
+	// Weakly consistent: entries inserted or erased during the scan may or may not show up, but writers
+	// are never blocked. fn runs inside an epoch guard, so it should be short.
+	template <typename Fn>
+	void range_scan(const Key& lo, const Key& hi, Fn fn)
+	{
+		epoch_reclamation::guard g;
+		std::atomic<node*>* preds[max_level];
+		node* succs[max_level];
+		find(lo, preds, succs);
+		for (node* n = succs[0]; less_than(n, hi); )
+		{
+			node* next = n->links()[0].load();
+			if (!is_marked(next)) // marked nodes are deleted, but their links still lead forward
+			{
+				fn(n->key, n->value);
+			}
+			n = unmarked(next);
+		}
+	}
+};
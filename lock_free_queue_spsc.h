@@ -1,6 +1,8 @@
 #pragma once
 #include <memory>
 #include <atomic>
+#include <optional>
+#include <utility>
 
 // single producer single consumer lock free queue
 
@@ -10,7 +12,7 @@ class lock_free_queue_spsc
 private:
 	struct node
 	{
-		std::shared_ptr<T> data;
+		std::optional<T> data; // stored inline, empty in the dummy node
 		node* next;
 		node() : next(nullptr) {}
 	};
@@ -25,7 +27,11 @@ public:
 	~lock_free_queue_spsc();
 	
 	void pop(std::shared_ptr<T>& out_val);
+	bool try_pop(T& out_val);
+	std::optional<T> try_pop();
 	void push(T val);
+	template <typename... Args>
+	void emplace(Args&&... args);
 };
 
 template<typename T>
@@ -53,23 +59,50 @@ lock_free_queue_spsc<T>::~lock_free_queue_spsc()
 
 template<typename T>
 void lock_free_queue_spsc<T>::pop(std::shared_ptr<T>& out_val)
+{
+	std::optional<T> res = try_pop();
+	out_val = res ? std::make_shared<T>(std::move(*res)) : nullptr;
+}
+
+template<typename T>
+bool lock_free_queue_spsc<T>::try_pop(T& out_val)
 {
 	node* old_head = pop_head();
 	if (!old_head)
 	{
-		out_val = nullptr;
-		return;
+		return false;
 	}
-	out_val = old_head->data;
+	out_val = std::move(*old_head->data);
 	delete old_head;
+	return true;
+}
+
+template<typename T>
+std::optional<T> lock_free_queue_spsc<T>::try_pop()
+{
+	node* old_head = pop_head();
+	if (!old_head)
+	{
+		return std::nullopt;
+	}
+	std::optional<T> res(std::move(old_head->data));
+	delete old_head;
+	return res;
 }
 
 template<typename T>
 void lock_free_queue_spsc<T>::push(T val)
+{
+	emplace(std::move(val));
+}
+
+template<typename T>
+template<typename... Args>
+void lock_free_queue_spsc<T>::emplace(Args&&... args)
 {
 	node* new_dummy = new node();
 	node* old_tail = tail.load();
-	old_tail->data = std::make_shared(val);
+	old_tail->data.emplace(std::forward<Args>(args)...); // only the producer touches the tail node, so construct it right there
 	old_tail->next = new_dummy;
 	tail.store(new_dummy);
 }
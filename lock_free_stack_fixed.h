@@ -1,6 +1,8 @@
 #pragma once
 #include <atomic>
 #include <memory>
+#include <optional>
+#include <utility>
 
 /*
 	Downside:
@@ -16,14 +18,15 @@ private:
 
 	struct node
 	{
-		std::shared_ptr<T> data;
-		node* next;
-		node(T const& data_) : data(std::make_shared(data_)) {}
+		T data; // stored inline, only the thread that unlinked the node reads it
+		node* next = nullptr;
+		template <typename... Args>
+		node(Args&&... args) : data(std::forward<Args>(args)...) {}
 	};
 
-	std::atomic<node*> head;
-	std::atomic<unsigned> threads_in_pop;
-	std::atomic<node*> to_be_deleted;
+	std::atomic<node*> head{ nullptr };
+	std::atomic<unsigned> threads_in_pop{ 0 };
+	std::atomic<node*> to_be_deleted{ nullptr };
 
 	void try_reclaim(node* old_head)
 	{
@@ -99,22 +102,50 @@ public:
 
 	void push(T const& data)
 	{
-		node* const new_node = new node(data);
+		emplace(data);
+	}
+
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		node* const new_node = new node(std::forward<Args>(args)...);
 		new_node->next = head.load();
 		while (!head.compare_exchange_weak(new_node->next, new_node)) { ; }
 	}
 
-	std::shared_ptr<T> pop()
+	std::optional<T> try_pop()
 	{
 		++threads_in_pop;
 		node* old_head = head.load();
 		while (old_head && !head.compare_exchange_weak(old_head, old_head->next)) { ; }
-		std::shared_ptr<T> res;
+		std::optional<T> res;
 		if (old_head)
 		{
-			res->data = std::move(old_head->data());
+			res.emplace(std::move(old_head->data));
 			try_reclaim(old_head);
 		}
+		else
+		{
+			--threads_in_pop; // nothing to reclaim, but we still have to leave pop
+		}
 		return res;
 	}
+
+	bool try_pop(T& out_val)
+	{
+		std::optional<T> res = try_pop();
+		if (!res)
+		{
+			return false;
+		}
+		out_val = std::move(*res);
+		return true;
+	}
+
+	// kept for existing callers, allocates the shared_ptr's control block on every call
+	std::shared_ptr<T> pop()
+	{
+		std::optional<T> res = try_pop();
+		return res ? std::make_shared<T>(std::move(*res)) : nullptr;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// lock free lists mark a node as deleted by setting the lowest bit of its next pointer.
+// That bit is always 0 in a real pointer, because nodes are at least 2 byte aligned.
+
+template <typename T>
+bool is_marked(T* p)
+{
+	return reinterpret_cast<std::uintptr_t>(p) & 1;
+}
+
+template <typename T>
+T* marked(T* p)
+{
+	return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(p) | 1);
+}
+
+template <typename T>
+T* unmarked(T* p)
+{
+	return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(p) & ~std::uintptr_t(1));
+}
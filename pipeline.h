@@ -0,0 +1,568 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "bounded_queue_spsc.h"
+#include "cpu_relax.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+	Staged pipeline: every stage runs on its own thread(s), stages are connected by bounded_queue_spsc queues.
+
+	A stage with N replicas runs on N threads. Between a stage with M replicas and the next one with N
+	replicas there are M x N queues, one per pair, so every queue still has exactly one producer and one
+	consumer. A producer replica sends its batches round robin to the consumer replicas.
+
+	Items travel in batches: a stage pops up to batch_size items with a single index update, runs the stage
+	function on all of them and pushes the results with a single index update.
+
+	Backpressure: if all queues to the next stage are full, a stage waits (and counts it in backpressure_waits)
+	until there's room again. So a slow stage makes its input queues fill up, then the stage before it stalls,
+	and so on back to push(). stats() shows this directly: the bottleneck is the stage with full input queues
+	whose predecessor has lots of backpressure_waits and which itself has few idle_polls.
+
+	A stage function takes the item by value and returns the item for the next stage, or a std::optional
+	of it (std::nullopt drops the item, e.g. for filters or aggregations that only emit once in a while).
+	The sink function returns nothing. Exceptions escaping a stage function terminate the program.
+	Every replica gets its own copy of the stage function, so a mutable lambda can keep state (e.g. a running
+	sum) without locking, but that state is per replica. A stage function that can't be copied only works
+	with a single replica.
+
+	example usage:
+	auto p = pipeline_builder<std::string>(1024, 64)
+		.stage("parse", [](std::string line) { return parse(line); }, { .pin_to_cpu = 1 })
+		.stage("transform", [](record r) { return transform(r); }, { .replicas = 4, .pin_to_cpu = 2 })
+		.sink("emit", [](record r) { emit(r); }, { .pin_to_cpu = 6 });
+	for (std::string& line : lines)
+		p.push(std::move(line));	// from one thread only
+	p.wait();						// no more input, wait until everything went through
+	for (const stage_stats& s : p.stats())
+		std::cout << s.name << ": " << s.items_per_second << " items/s, input " << s.input_occupancy << '/' << s.input_capacity << '\n';
+*/
+
+struct stage_options
+{
+	unsigned replicas = 1;
+	int pin_to_cpu = -1; // replica r runs on cpu pin_to_cpu + r, -1 = let the OS decide
+};
+
+struct stage_stats
+{
+	std::string name;
+	unsigned replicas;
+	std::uint64_t items_processed;
+	std::size_t input_occupancy;		// items waiting in the input queues right now
+	std::size_t input_capacity;
+	std::uint64_t idle_polls;			// how often the stage found its input queues empty
+	std::uint64_t backpressure_waits;	// how often the stage found all output queues full
+	double items_per_second;			// since the pipeline was started
+};
+
+inline void pin_this_thread_to_cpu(unsigned cpu)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)cpu; // not supported, just don't pin
+#endif
+}
+
+// M x N spsc queues between the M replicas of one stage and the N replicas of the next
+template <typename T>
+class pipeline_channel
+{
+private:
+
+	const unsigned num_producers;
+	const unsigned num_consumers;
+	std::vector<std::unique_ptr<bounded_queue_spsc<T>>> queues;
+	std::unique_ptr<std::atomic<bool>[]> closed; // one per producer
+
+public:
+
+	pipeline_channel(unsigned producers, unsigned consumers, std::size_t capacity)
+		: num_producers(producers), num_consumers(consumers), closed(new std::atomic<bool>[producers])
+	{
+		for (unsigned i = 0; i < producers * consumers; ++i)
+		{
+			queues.push_back(std::make_unique<bounded_queue_spsc<T>>(capacity));
+		}
+		for (unsigned i = 0; i < producers; ++i)
+		{
+			closed[i].store(false, std::memory_order_relaxed);
+		}
+	}
+
+	unsigned producers() const { return num_producers; }
+	unsigned consumers() const { return num_consumers; }
+
+	bounded_queue_spsc<T>& queue(unsigned producer, unsigned consumer)
+	{
+		return *queues[producer * num_consumers + consumer];
+	}
+
+	// the producer won't push anymore
+	void close(unsigned producer)
+	{
+		closed[producer].store(true, std::memory_order_release);
+	}
+
+	// check this *before* popping: if it was closed and the pop came back empty, the queue is done for good
+	bool is_closed(unsigned producer) const
+	{
+		return closed[producer].load(std::memory_order_acquire);
+	}
+
+	// pushes items [first, first + n) of one producer, round robin over the consumers, waits while everything is full
+	template <typename It>
+	std::uint64_t push_blocking(unsigned producer, unsigned& next_consumer, It first, std::size_t n)
+	{
+		std::uint64_t waits = 0;
+		unsigned full_in_a_row = 0;
+		while (n > 0)
+		{
+			std::size_t pushed = queue(producer, next_consumer).try_push_bulk(first, n);
+			first += pushed;
+			n -= pushed;
+			next_consumer = (next_consumer + 1) % num_consumers;
+			if (pushed > 0)
+			{
+				full_in_a_row = 0;
+			}
+			else if (++full_in_a_row == num_consumers)
+			{
+				// the next stage can't keep up, give it our time slice
+				full_in_a_row = 0;
+				++waits;
+				std::this_thread::yield();
+			}
+		}
+		return waits;
+	}
+
+	std::size_t occupancy(unsigned consumer) const
+	{
+		std::size_t res = 0;
+		for (unsigned p = 0; p < num_producers; ++p)
+		{
+			res += queues[p * num_consumers + consumer]->size_approx();
+		}
+		return res;
+	}
+
+	std::size_t capacity_per_consumer() const
+	{
+		return num_producers * queues.front()->capacity();
+	}
+};
+
+class pipeline_stage_base
+{
+public:
+	virtual ~pipeline_stage_base() = default;
+	virtual void start() = 0;
+	virtual void join() = 0;
+	virtual stage_stats stats(double elapsed_seconds) const = 0;
+};
+
+// a stage whose output channel is wired in after construction, once the builder knows the next stage's replicas
+template <typename Out>
+class pipeline_stage_with_output : public pipeline_stage_base
+{
+public:
+	void set_output(pipeline_channel<Out>* output_) { output = output_; }
+
+protected:
+	pipeline_channel<Out>* output = nullptr;
+};
+
+template <typename R>
+struct pipeline_stage_result
+{
+	using type = R;
+	static constexpr bool can_drop = false;
+};
+
+template <typename R>
+struct pipeline_stage_result<std::optional<R>>
+{
+	using type = R;
+	static constexpr bool can_drop = true;
+};
+
+// Out = void for the sink
+template <typename In, typename Out, typename Fn>
+class pipeline_stage : public pipeline_stage_with_output<std::conditional_t<std::is_void_v<Out>, std::monostate, Out>>
+{
+private:
+
+	static constexpr bool is_sink = std::is_void_v<Out>;
+	using output_batch = std::vector<std::conditional_t<is_sink, std::monostate, Out>>;
+	using pipeline_stage_with_output<std::conditional_t<is_sink, std::monostate, Out>>::output;
+
+	// per replica, on separate cache lines so the replicas don't fight over them
+	struct alignas(64) counters
+	{
+		std::atomic<std::uint64_t> items_processed{ 0 };
+		std::atomic<std::uint64_t> idle_polls{ 0 };
+		std::atomic<std::uint64_t> backpressure_waits{ 0 };
+	};
+
+	static constexpr int idle_spins_before_yield = 64;
+
+	const std::string name;
+	std::vector<Fn> fns; // one per replica, so stateful functions don't race
+	const stage_options options;
+	const std::size_t batch_size;
+	pipeline_channel<In>& input;
+	std::unique_ptr<counters[]> replica_counters;
+	std::vector<std::thread> threads;
+
+	void process(Fn& fn, std::vector<In>& in, output_batch& out)
+	{
+		for (In& item : in)
+		{
+			if constexpr (is_sink)
+			{
+				fn(std::move(item));
+			}
+			else if constexpr (pipeline_stage_result<std::invoke_result_t<Fn&, In&&>>::can_drop)
+			{
+				if (auto res = fn(std::move(item)))
+				{
+					out.push_back(std::move(*res));
+				}
+			}
+			else
+			{
+				out.push_back(fn(std::move(item)));
+			}
+		}
+		in.clear();
+	}
+
+	void run(unsigned replica)
+	{
+		if (options.pin_to_cpu >= 0)
+		{
+			pin_this_thread_to_cpu(options.pin_to_cpu + replica);
+		}
+		counters& c = replica_counters[replica];
+		std::vector<In> in_batch;
+		in_batch.reserve(batch_size);
+		output_batch out_batch;
+		out_batch.reserve(batch_size);
+		unsigned next_consumer = output ? replica % output->consumers() : 0;
+		int idle_spins = 0;
+
+		while (true)
+		{
+			bool got_any = false;
+			bool all_done = true;
+			for (unsigned producer = 0; producer < input.producers(); ++producer)
+			{
+				const bool closed = input.is_closed(producer);
+				const std::size_t n = input.queue(producer, replica).try_pop_bulk(std::back_inserter(in_batch), batch_size);
+				if (n == 0)
+				{
+					all_done = all_done && closed;
+					continue;
+				}
+				all_done = false;
+				got_any = true;
+				process(fns[replica], in_batch, out_batch);
+				c.items_processed.fetch_add(n, std::memory_order_relaxed);
+				if constexpr (!is_sink)
+				{
+					if (std::uint64_t waits = output->push_blocking(replica, next_consumer, out_batch.begin(), out_batch.size()))
+					{
+						c.backpressure_waits.fetch_add(waits, std::memory_order_relaxed);
+					}
+					out_batch.clear();
+				}
+			}
+			if (all_done)
+			{
+				break;
+			}
+			if (got_any)
+			{
+				idle_spins = 0;
+			}
+			else
+			{
+				c.idle_polls.fetch_add(1, std::memory_order_relaxed);
+				if (++idle_spins < idle_spins_before_yield)
+				{
+					cpu_relax();
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		if constexpr (!is_sink)
+		{
+			output->close(replica);
+		}
+	}
+
+public:
+
+	pipeline_stage(std::string name_, Fn fn_, stage_options options_, std::size_t batch_size_, pipeline_channel<In>& input_)
+		: name(std::move(name_)), options(options_), batch_size(batch_size_), input(input_),
+		replica_counters(new counters[options_.replicas])
+	{
+		fns.reserve(options.replicas);
+		if constexpr (std::is_copy_constructible_v<Fn>)
+		{
+			for (unsigned replica = 1; replica < options.replicas; ++replica)
+			{
+				fns.push_back(fn_);
+			}
+		}
+		else if (options.replicas > 1)
+		{
+			throw std::invalid_argument("stage \"" + name + "\": a move only stage function can't be copied for several replicas");
+		}
+		fns.push_back(std::move(fn_));
+	}
+
+	void start() override
+	{
+		for (unsigned replica = 0; replica < options.replicas; ++replica)
+		{
+			threads.emplace_back(&pipeline_stage::run, this, replica);
+		}
+	}
+
+	void join() override
+	{
+		for (std::thread& t : threads)
+		{
+			if (t.joinable())
+			{
+				t.join();
+			}
+		}
+	}
+
+	stage_stats stats(double elapsed_seconds) const override
+	{
+		stage_stats res{ name, options.replicas, 0, 0, 0, 0, 0, 0.0 };
+		for (unsigned replica = 0; replica < options.replicas; ++replica)
+		{
+			const counters& c = replica_counters[replica];
+			res.items_processed += c.items_processed.load(std::memory_order_relaxed);
+			res.idle_polls += c.idle_polls.load(std::memory_order_relaxed);
+			res.backpressure_waits += c.backpressure_waits.load(std::memory_order_relaxed);
+			res.input_occupancy += input.occupancy(replica);
+			res.input_capacity += input.capacity_per_consumer();
+		}
+		res.items_per_second = elapsed_seconds > 0 ? res.items_processed / elapsed_seconds : 0.0;
+		return res;
+	}
+};
+
+// everything the builder creates, owned by the finished pipeline
+struct pipeline_parts
+{
+	std::size_t queue_capacity;
+	std::size_t batch_size;
+	std::vector<std::shared_ptr<void>> channels;
+	std::vector<std::unique_ptr<pipeline_stage_base>> stages;
+	void* source = nullptr; // pipeline_channel<In>* that push() feeds
+	std::chrono::steady_clock::time_point start_time;
+};
+
+template <typename In>
+class pipeline
+{
+private:
+
+	std::unique_ptr<pipeline_parts> parts;
+	unsigned next_consumer = 0;
+	std::size_t pushed_to_current = 0;
+	bool closed = false;
+
+	pipeline_channel<In>& source()
+	{
+		return *static_cast<pipeline_channel<In>*>(parts->source);
+	}
+
+public:
+
+	explicit pipeline(std::unique_ptr<pipeline_parts> parts_) : parts(std::move(parts_))
+	{
+		parts->start_time = std::chrono::steady_clock::now();
+		for (auto& stage : parts->stages)
+		{
+			stage->start();
+		}
+	}
+
+	pipeline(pipeline&& other) = default;
+	pipeline& operator=(pipeline&& other) = delete;
+
+	~pipeline()
+	{
+		if (parts)
+		{
+			wait();
+		}
+	}
+
+	// producer side, from one thread only. Blocks while the first stage is too far behind
+	void push(In item)
+	{
+		// fill the first stage's replicas one batch at a time, so they get whole batches to work on
+		if (pushed_to_current == parts->batch_size)
+		{
+			pushed_to_current = 0;
+			next_consumer = (next_consumer + 1) % source().consumers();
+		}
+		unsigned consumer = next_consumer;
+		source().push_blocking(0, consumer, &item, 1);
+		++pushed_to_current;
+	}
+
+	template <typename InputIt>
+	void push_range(InputIt first, InputIt last)
+	{
+		std::vector<In> batch(first, last);
+		source().push_blocking(0, next_consumer, batch.begin(), batch.size());
+	}
+
+	// no more input, the stages shut down one after the other once they've processed everything
+	void close()
+	{
+		if (!closed)
+		{
+			closed = true;
+			source().close(0);
+		}
+	}
+
+	// closes the input and waits until every item went through the sink
+	void wait()
+	{
+		close();
+		for (auto& stage : parts->stages)
+		{
+			stage->join();
+		}
+	}
+
+	std::vector<stage_stats> stats() const
+	{
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - parts->start_time).count();
+		std::vector<stage_stats> res;
+		for (const auto& stage : parts->stages)
+		{
+			res.push_back(stage->stats(elapsed));
+		}
+		return res;
+	}
+};
+
+// In is what push() takes, Out is what the last stage so far produces
+template <typename In, typename Out = In>
+class pipeline_builder
+{
+private:
+
+	template <typename, typename> friend class pipeline_builder;
+
+	std::unique_ptr<pipeline_parts> parts;
+	// the last stage added so far (owned by parts). Its output channel can only be created
+	// once we know how many replicas read from it, i.e. when the next stage is added.
+	pipeline_stage_with_output<Out>* last_stage = nullptr;
+	unsigned last_replicas = 1;
+
+	explicit pipeline_builder(std::unique_ptr<pipeline_parts> parts_) : parts(std::move(parts_)) {}
+
+	// creates the channel the next stage reads from and connects the last stage (or push()) to it
+	pipeline_channel<Out>* connect(unsigned replicas)
+	{
+		auto channel = std::make_shared<pipeline_channel<Out>>(last_stage ? last_replicas : 1, replicas, parts->queue_capacity);
+		if (last_stage)
+		{
+			last_stage->set_output(channel.get());
+		}
+		else
+		{
+			parts->source = channel.get();
+		}
+		parts->channels.push_back(channel);
+		return channel.get();
+	}
+
+public:
+
+	explicit pipeline_builder(std::size_t queue_capacity = 1024, std::size_t batch_size = 64)
+		: parts(std::make_unique<pipeline_parts>())
+	{
+		parts->queue_capacity = queue_capacity;
+		parts->batch_size = batch_size > 0 ? batch_size : 1;
+	}
+
+	template <typename Fn>
+	auto stage(std::string name, Fn fn, stage_options options = {}) &&
+	{
+		using result_type = typename pipeline_stage_result<std::invoke_result_t<Fn&, Out&&>>::type;
+		if (options.replicas == 0)
+		{
+			options.replicas = 1;
+		}
+		pipeline_channel<Out>* input = connect(options.replicas);
+		auto stage = std::make_unique<pipeline_stage<Out, result_type, Fn>>(std::move(name), std::move(fn), options, parts->batch_size, *input);
+		pipeline_stage_with_output<result_type>* added = stage.get();
+		parts->stages.push_back(std::move(stage));
+
+		pipeline_builder<In, result_type> next(std::move(parts));
+		next.last_stage = added;
+		next.last_replicas = options.replicas;
+		return next;
+	}
+
+	// adds the final stage and starts all threads
+	template <typename Fn>
+	pipeline<In> sink(std::string name, Fn fn, stage_options options = {}) &&
+	{
+		if (options.replicas == 0)
+		{
+			options.replicas = 1;
+		}
+		pipeline_channel<Out>* input = connect(options.replicas);
+		parts->stages.push_back(std::make_unique<pipeline_stage<Out, void, Fn>>(std::move(name), std::move(fn), options, parts->batch_size, *input));
+		return pipeline<In>(std::move(parts));
+	}
+};
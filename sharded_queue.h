@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "this_thread.h"
+#include "threadsafe_queue.h"
+
+/*
+	Queue made of several threadsafe_queue lanes. Every thread has a home lane (thread index modulo the
+	number of lanes): it pushes there, and it pops from there first. Only if its home lane is empty it
+	tries to steal from the other lanes, visiting them in random order so that idle consumers don't all
+	pile onto the same victim. With about one lane per core, most operations only touch the home lane's
+	locks and cache lines, which stay on the thread's own core.
+
+	The price is ordering: elements pushed by one thread come out in the order they were pushed, but
+	there is no order between elements pushed by different threads. try_pop may also report empty while
+	another thread is in the middle of pushing into a lane that was already checked.
+
+	With strict_fifo = true, there is only a single lane, i.e. it's a plain threadsafe_queue again.
+
+	example usage:
+	sharded_queue<int> queue; // one lane per hardware thread
+	std::thread producer([&] { for (int i = 0; i < 100; ++i) queue.push(i); });
+	std::thread consumer([&] { int val; while (true) { if (queue.try_pop(val)) process(val); } });
+*/
+
+template <typename T>
+class sharded_queue
+{
+private:
+
+	// lanes on separate cache lines, so that one lane's locks don't false share with its neighbor's
+	struct alignas(64) lane
+	{
+		threadsafe_queue<T> queue;
+	};
+
+	std::vector<lane> lanes;
+
+	lane& home_lane()
+	{
+		return lanes[this_thread_index() % lanes.size()];
+	}
+
+	template <typename Pop>
+	bool pop_any(Pop pop)
+	{
+		const std::size_t n = lanes.size();
+		const std::size_t home = this_thread_index() % n;
+		if (pop(lanes[home].queue))
+		{
+			return true;
+		}
+		// steal, visiting the other lanes in random order: a random start and a random step that is
+		// coprime to n, so that every lane is visited exactly once
+		const std::size_t start = this_thread_random() % n;
+		std::size_t step = 1;
+		if (n > 2)
+		{
+			do
+			{
+				step = 1 + this_thread_random() % (n - 1);
+			} while (std::gcd(step, n) != 1);
+		}
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			const std::size_t victim = (start + i * step) % n;
+			if (victim != home && pop(lanes[victim].queue))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+
+	explicit sharded_queue(std::size_t num_lanes = std::max(1u, std::thread::hardware_concurrency()), bool strict_fifo = false)
+		: lanes(strict_fifo ? 1 : std::max<std::size_t>(num_lanes, 1)) {}
+
+	sharded_queue(const sharded_queue& other) = delete;
+	sharded_queue& operator=(const sharded_queue& other) = delete;
+
+	void push(T new_value)
+	{
+		home_lane().queue.push(std::move(new_value));
+	}
+
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		home_lane().queue.emplace(std::forward<Args>(args)...);
+	}
+
+	template <typename InputIt>
+	void push_range(InputIt first, InputIt last)
+	{
+		home_lane().queue.push_range(first, last);
+	}
+
+	bool try_pop(T& out_val)
+	{
+		return pop_any([&](threadsafe_queue<T>& queue) { return queue.try_pop(out_val); });
+	}
+
+	std::optional<T> try_pop()
+	{
+		std::optional<T> res;
+		pop_any([&](threadsafe_queue<T>& queue) { res = queue.try_pop(); return res.has_value(); });
+		return res;
+	}
+
+	std::size_t num_lanes() const
+	{
+		return lanes.size();
+	}
+};
@@ -0,0 +1,371 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#if defined(_WIN32)
+#error "shm_queue_spsc.h uses POSIX shared memory (shm_open + mmap), on Windows this would need CreateFileMapping"
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// single producer single consumer queue between two processes
+
+/*
+	Same idea as bounded_queue_spsc, but the ring buffer lives in a POSIX shared memory segment that both
+	processes map. The producer writes a message straight into the ring, the consumer reads it right there,
+	no copy into or out of a socket buffer and no system call per message.
+
+	Messages have variable length. Every record is an 8 byte header (length and type) followed by the
+	payload, padded to 8 bytes. A record never wraps around the end of the buffer: if it doesn't fit
+	anymore, the producer fills the rest with a padding record that the consumer skips.
+
+	Nothing in the segment is a pointer, only offsets, because the segment is mapped at a different
+	address in each process. head and tail only ever grow (64 bit, so they won't overflow), the position
+	in the ring is index & mask.
+
+	The std::atomics in the segment work between processes because they are lock free (checked below).
+
+	Both sides write their pid into the segment, so each can check with peer_alive() whether the other
+	process still exists, e.g. to stop waiting for messages from a producer that crashed.
+
+	example usage:
+	// producer process
+	shm_queue_spsc q = shm_queue_spsc::create("/ingest", 1 << 20);
+	if (std::byte* buf = q.try_reserve(sizeof(my_message)))
+	{
+		new (buf) my_message{ ... };	// build the message in place
+		q.commit();						// now the consumer can see it
+	}
+
+	// consumer process
+	shm_queue_spsc q = shm_queue_spsc::open("/ingest");
+	if (auto msg = q.try_peek())
+	{
+		handle(reinterpret_cast<const my_message*>(msg->data()), msg->size()); // reads the shared memory directly
+		q.release();															// now the producer may overwrite it
+	}
+*/
+
+class shm_queue_spsc
+{
+public:
+
+	enum class role { producer, consumer };
+
+private:
+
+	static constexpr std::uint32_t magic_value = 0x53505343; // "SPSC"
+	static constexpr std::uint32_t record_data = 0;
+	static constexpr std::uint32_t record_padding = 1;
+	static constexpr std::size_t alignment = 8;
+
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "atomics in shared memory have to be lock free");
+	static_assert(std::atomic<std::int32_t>::is_always_lock_free, "atomics in shared memory have to be lock free");
+
+	// layout of the segment, followed directly by the ring
+	struct shm_header
+	{
+		std::atomic<std::uint32_t> magic;	// written last by the creator, once everything else is initialized
+		std::uint64_t capacity;				// bytes in the ring, power of two
+
+		alignas(64) std::atomic<std::uint64_t> head;	// written by the consumer
+		std::atomic<std::int32_t> consumer_pid;
+
+		alignas(64) std::atomic<std::uint64_t> tail;	// written by the producer
+		std::atomic<std::int32_t> producer_pid;
+	};
+
+	struct record_header
+	{
+		std::uint32_t length; // payload bytes, without header and padding
+		std::uint32_t type;
+	};
+
+	static_assert(sizeof(record_header) == alignment);
+
+	std::string name;
+	role my_role = role::consumer;
+	shm_header* header = nullptr;
+	std::byte* ring = nullptr;
+	std::size_t mapped_size = 0;
+	std::uint64_t mask = 0;
+
+	// producer only
+	std::uint64_t cached_head = 0;
+	std::uint64_t reserved_tail = 0;
+
+	// consumer only
+	std::uint64_t cached_tail = 0;
+	std::uint64_t peeked_size = 0;
+
+	static std::size_t aligned(std::size_t n)
+	{
+		return (n + alignment - 1) & ~(alignment - 1);
+	}
+
+	[[noreturn]] static void throw_errno(const char* what)
+	{
+		throw std::system_error(errno, std::generic_category(), what);
+	}
+
+	[[noreturn]] static void throw_corrupt()
+	{
+		throw std::system_error(std::make_error_code(std::errc::bad_message), "shm queue contains a corrupt record");
+	}
+
+	void map(int fd, std::size_t size)
+	{
+		void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd); // the mapping keeps the segment alive
+		if (mem == MAP_FAILED)
+		{
+			throw_errno("mmap");
+		}
+		mapped_size = size;
+		header = static_cast<shm_header*>(mem);
+		ring = static_cast<std::byte*>(mem) + aligned_header_size();
+	}
+
+	static std::size_t aligned_header_size()
+	{
+		return (sizeof(shm_header) + 63) & ~std::size_t(63);
+	}
+
+	record_header* record_at(std::uint64_t pos)
+	{
+		return reinterpret_cast<record_header*>(ring + (pos & mask));
+	}
+
+	shm_queue_spsc(std::string name_, role role_) : name(std::move(name_)), my_role(role_) {}
+
+public:
+
+	// producer side: creates the segment (replacing a stale one left behind by a crashed run)
+	static shm_queue_spsc create(const std::string& name, std::size_t capacity)
+	{
+		shm_queue_spsc q(name, role::producer);
+		const std::uint64_t ring_size = std::bit_ceil(std::max<std::uint64_t>(capacity, 64));
+		const std::size_t size = aligned_header_size() + ring_size;
+
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+		{
+			throw_errno("shm_open");
+		}
+		if (ftruncate(fd, static_cast<off_t>(size)) != 0) // new pages are zero filled
+		{
+			::close(fd);
+			throw_errno("ftruncate");
+		}
+		q.map(fd, size);
+
+		q.header->capacity = ring_size;
+		q.header->head.store(0, std::memory_order_relaxed);
+		q.header->tail.store(0, std::memory_order_relaxed);
+		q.header->consumer_pid.store(0, std::memory_order_relaxed);
+		q.header->producer_pid.store(getpid(), std::memory_order_relaxed);
+		q.header->magic.store(magic_value, std::memory_order_release);
+		q.mask = ring_size - 1;
+		return q;
+	}
+
+	// consumer side: opens a segment created by the producer
+	static shm_queue_spsc open(const std::string& name)
+	{
+		shm_queue_spsc q(name, role::consumer);
+		int fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd < 0)
+		{
+			throw_errno("shm_open");
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) <= aligned_header_size())
+		{
+			::close(fd);
+			throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "shm segment not initialized yet");
+		}
+		q.map(fd, static_cast<std::size_t>(st.st_size));
+		if (q.header->magic.load(std::memory_order_acquire) != magic_value)
+		{
+			throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "shm segment not initialized yet");
+		}
+		// don't trust the segment blindly, a wrong capacity would let us read and write past the mapping
+		const std::uint64_t ring_size = q.header->capacity;
+		if (!std::has_single_bit(ring_size) || ring_size < alignment || ring_size > q.mapped_size - aligned_header_size())
+		{
+			throw std::system_error(std::make_error_code(std::errc::invalid_argument), "shm segment has an invalid capacity");
+		}
+		q.mask = ring_size - 1;
+		q.cached_tail = q.header->head.load(std::memory_order_relaxed);
+		q.header->consumer_pid.store(getpid(), std::memory_order_release);
+		return q;
+	}
+
+	shm_queue_spsc(shm_queue_spsc&& other) noexcept
+		: name(std::move(other.name)), my_role(other.my_role), header(std::exchange(other.header, nullptr)), ring(other.ring),
+		mapped_size(other.mapped_size), mask(other.mask), cached_head(other.cached_head), reserved_tail(other.reserved_tail),
+		cached_tail(other.cached_tail), peeked_size(other.peeked_size) {}
+
+	shm_queue_spsc(const shm_queue_spsc& other) = delete;
+	shm_queue_spsc& operator=(const shm_queue_spsc& other) = delete;
+	shm_queue_spsc& operator=(shm_queue_spsc&& other) = delete;
+
+	// the producer removes the name, a consumer that has it mapped already keeps working
+	~shm_queue_spsc()
+	{
+		if (!header)
+		{
+			return;
+		}
+		munmap(header, mapped_size);
+		if (my_role == role::producer)
+		{
+			shm_unlink(name.c_str());
+		}
+	}
+
+	std::size_t capacity() const
+	{
+		return static_cast<std::size_t>(mask + 1);
+	}
+
+	// largest payload that try_reserve can ever hand out (the record header stores the length in 32 bits)
+	std::size_t max_message_size() const
+	{
+		return static_cast<std::size_t>(std::min<std::uint64_t>(capacity() / 2 - sizeof(record_header), UINT32_MAX));
+	}
+
+	// producer only. Returns space for n bytes inside the ring, or nullptr if the ring is too full right now.
+	// The bytes become visible to the consumer with commit(). Only one reservation at a time.
+	// Throws std::length_error if n > max_message_size(): depending on where in the ring the tail is, such
+	// a message might never fit, and retrying on nullptr would spin forever.
+	std::byte* try_reserve(std::size_t n)
+	{
+		assert(my_role == role::producer);
+		if (n > max_message_size())
+		{
+			throw std::length_error("shm_queue_spsc: message is larger than max_message_size()");
+		}
+		const std::uint64_t t = header->tail.load(std::memory_order_relaxed);
+		const std::uint64_t needed = aligned(sizeof(record_header) + n);
+		const std::uint64_t to_end = capacity() - (t & mask);
+		const std::uint64_t padding = needed > to_end ? to_end : 0;
+
+		if (capacity() - (t - cached_head) < padding + needed)
+		{
+			cached_head = header->head.load(std::memory_order_acquire);
+			if (capacity() - (t - cached_head) < padding + needed)
+			{
+				return nullptr;
+			}
+		}
+
+		std::uint64_t pos = t;
+		if (padding)
+		{
+			*record_at(pos) = record_header{ static_cast<std::uint32_t>(padding - sizeof(record_header)), record_padding };
+			pos += padding;
+		}
+		record_header* rec = record_at(pos);
+		*rec = record_header{ static_cast<std::uint32_t>(n), record_data };
+		reserved_tail = pos + needed;
+		return reinterpret_cast<std::byte*>(rec + 1);
+	}
+
+	// producer only. Publishes the record from the last try_reserve
+	void commit()
+	{
+		assert(my_role == role::producer);
+		header->tail.store(reserved_tail, std::memory_order_release);
+	}
+
+	// producer only. Copies data into the ring, returns false if there's no room right now.
+	// Throws std::length_error if n > max_message_size()
+	bool try_push(const void* data, std::size_t n)
+	{
+		std::byte* buf = try_reserve(n);
+		if (!buf)
+		{
+			return false;
+		}
+		std::memcpy(buf, data, n);
+		commit();
+		return true;
+	}
+
+	// consumer only. Returns the oldest message, still inside the shared memory, without removing it.
+	// It stays valid until release() is called.
+	// The record headers come from the other process, so they are checked before they are used: a broken
+	// or malicious producer must not make us read past the ring. Throws std::system_error (bad_message)
+	// if a record doesn't fit into what the producer has published, or into the rest of the ring.
+	std::optional<std::span<const std::byte>> try_peek()
+	{
+		assert(my_role == role::consumer);
+		std::uint64_t h = header->head.load(std::memory_order_relaxed);
+		if (h % alignment != 0) // head is in the segment too, a misaligned one would put the record header across the end of the ring
+		{
+			throw_corrupt();
+		}
+		while (true)
+		{
+			if (cached_tail == h)
+			{
+				cached_tail = header->tail.load(std::memory_order_acquire);
+				if (cached_tail == h)
+				{
+					return std::nullopt;
+				}
+			}
+			const record_header rec = *record_at(h); // copy it, the producer could change it after we checked it
+			const std::uint64_t size = aligned(sizeof(record_header) + rec.length);
+			if ((rec.type != record_data && rec.type != record_padding) || size > cached_tail - h || size > capacity() - (h & mask))
+			{
+				throw_corrupt();
+			}
+			if (rec.type == record_padding)
+			{
+				h += size;
+				header->head.store(h, std::memory_order_release);
+				continue;
+			}
+			peeked_size = size;
+			return std::span<const std::byte>(reinterpret_cast<const std::byte*>(record_at(h) + 1), rec.length);
+		}
+	}
+
+	// consumer only. Hands the space of the message from the last try_peek back to the producer
+	void release()
+	{
+		assert(my_role == role::consumer);
+		header->head.store(header->head.load(std::memory_order_relaxed) + peeked_size, std::memory_order_release);
+		peeked_size = 0;
+	}
+
+	// false if the other side never attached or its process is gone (pids can get reused, so this is a best effort check)
+	bool peer_alive() const
+	{
+		const pid_t pid = (my_role == role::producer ? header->consumer_pid : header->producer_pid).load(std::memory_order_acquire);
+		if (pid == 0)
+		{
+			return false;
+		}
+		return kill(pid, 0) == 0 || errno == EPERM; // EPERM: it exists, we just aren't allowed to signal it
+	}
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <atomic>
 #include <cassert>
+#include "cpu_relax.h"
 
 class spinlock_mutex
 {
@@ -10,7 +11,20 @@ public:
 
 	void lock()
 	{
-		while (flag.test_and_set(std::memory_order_acquire)) { ; }
+		while (flag.test_and_set(std::memory_order_acquire))
+		{
+			// wait with plain reads until the lock looks free, test_and_set would pull the cache line
+			// away from the owner on every try
+			while (flag.test(std::memory_order_relaxed))
+			{
+				cpu_relax();
+			}
+		}
+	}
+
+	bool try_lock()
+	{
+		return !flag.test_and_set(std::memory_order_acquire);
 	}
 
 	void unlock()
@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// small dense number for the calling thread (0 for the first thread that asks, 1 for the next, ...),
+// e.g. to give every thread its own slot or lane
+inline std::size_t this_thread_index()
+{
+	static std::atomic<std::size_t> next_index{ 0 };
+	thread_local std::size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+
+// cheap per thread pseudo random numbers (xorshift). The state is thread local, so unlike
+// std::rand there is no shared cache line that all threads fight over.
+inline std::uint64_t this_thread_random()
+{
+	thread_local std::uint64_t state = std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
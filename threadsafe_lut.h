@@ -5,6 +5,7 @@
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <mutex>
 #include <shared_mutex>
 #include <memory>
 
@@ -35,6 +36,8 @@ std::thread t6(value_for, &lut, 9, std::ref(s));
 
 t6.join();
 std::cout << s << std::endl;
+
+lock_free_lut.h has the same interface without any locks.
 */
 
 template<typename KeyType, typename ValueType>
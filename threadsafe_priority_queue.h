@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cpu_relax.h"
+#include "lock_free_ordered_map.h"
+#include "spinlock_mutex.h"
+#include "this_thread.h"
+
+/*
+	Concurrent priority queue, for the cases where one std::priority_queue behind one mutex doesn't scale.
+
+	relaxed mode ("MultiQueue"):
+	There are several heaps, each behind its own spinlock_mutex. push puts the element into a random heap,
+	try_pop_min picks two random heaps, and pops from the one with the better top element.
+	Threads almost never meet on the same lock, so this scales with the number of cores. The price
+	is that the element returned is not necessarily the global minimum, only one of the smallest
+	(in expectation the rank error is in the order of the number of heaps). Good enough for
+	deadline scheduling, where it doesn't matter if a job that's due a few microseconds later runs first.
+
+	strict mode:
+	The heaps aren't used (num_heaps is ignored). Instead the elements live in a lock_free_ordered_map,
+	keyed on (priority, pushing thread, per thread sequence number), so keys are unique and elements
+	with the same priority pushed by one thread come out in FIFO order. try_pop_min takes the first node
+	of the skip list with try_pop_front, so it returns the real minimum (of the elements that were pushed
+	before it started). Pushes go to different places in the list and don't get in each other's way,
+	pops all race for the front node, but without a lock: whoever loses just takes the next one.
+	Each element costs a node and a separate allocation for the value, so relaxed mode is still
+	cheaper when exact order isn't needed.
+
+	Each heap caches its top priority in an atomic, so picking the better of two heaps doesn't
+	need their locks. Because of that, Priority has to be trivially copyable (ints, floats,
+	std::chrono::time_point, ...).
+
+	example usage:
+	threadsafe_priority_queue<std::chrono::steady_clock::time_point, job> jobs(16, true);
+	jobs.push(std::chrono::steady_clock::now() + 5ms, job{ ... });
+	if (std::optional<job> next = jobs.try_pop_min())
+		next->run();
+*/
+
+template <typename Priority, typename T, typename Compare = std::less<Priority>>
+class threadsafe_priority_queue
+{
+	static_assert(std::is_trivially_copyable<Priority>::value, "Priority is cached in a std::atomic");
+
+private:
+
+	struct entry
+	{
+		Priority priority;
+		T value;
+	};
+
+	// every heap starts on its own cache line, otherwise threads working on neighboring heaps would false share
+	struct alignas(64) heap
+	{
+		spinlock_mutex mut;
+		std::vector<entry> entries;
+		std::atomic<bool> empty{ true };
+		std::atomic<Priority> top{};
+	};
+
+	static constexpr int max_random_attempts = 8;
+
+	struct strict_key
+	{
+		Priority priority;
+		std::size_t thread;
+		std::uint64_t sequence;
+	};
+
+	struct strict_key_order
+	{
+		Compare comp;
+
+		bool operator()(const strict_key& a, const strict_key& b) const
+		{
+			if (comp(a.priority, b.priority))
+			{
+				return true;
+			}
+			if (comp(b.priority, a.priority))
+			{
+				return false;
+			}
+			return a.thread != b.thread ? a.thread < b.thread : a.sequence < b.sequence;
+		}
+	};
+
+	std::vector<heap> heaps;
+	lock_free_ordered_map<strict_key, T*, strict_key_order> strict_entries; // map values are immutable, so T lives on the heap and gets moved out of there
+	const bool relaxed;
+	Compare comp;
+
+	// std heap functions build a max heap, so flip the comparison to get the minimum on top
+	bool heap_order(const entry& a, const entry& b) const
+	{
+		return comp(b.priority, a.priority);
+	}
+
+	heap& random_heap()
+	{
+		return heaps[this_thread_random() % heaps.size()];
+	}
+
+	// must hold h.mut
+	void update_cached_top(heap& h)
+	{
+		if (h.entries.empty())
+		{
+			h.empty.store(true, std::memory_order_relaxed);
+		}
+		else
+		{
+			h.top.store(h.entries.front().priority, std::memory_order_relaxed);
+			h.empty.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// must hold h.mut and h must not be empty
+	T pop_top(heap& h)
+	{
+		std::pop_heap(h.entries.begin(), h.entries.end(), [this](const entry& a, const entry& b) { return heap_order(a, b); });
+		T res = std::move(h.entries.back().value);
+		h.entries.pop_back();
+		update_cached_top(h);
+		return res;
+	}
+
+	// true if a's cached top is better than b's, empty heaps are worst
+	bool better_top(const heap& a, const heap& b) const
+	{
+		if (a.empty.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+		if (b.empty.load(std::memory_order_relaxed))
+		{
+			return true;
+		}
+		return comp(a.top.load(std::memory_order_relaxed), b.top.load(std::memory_order_relaxed));
+	}
+
+	std::optional<T> try_pop_min_relaxed()
+	{
+		for (int attempt = 0; attempt < max_random_attempts; ++attempt)
+		{
+			heap& a = random_heap();
+			heap& b = random_heap();
+			heap& candidate = better_top(b, a) ? b : a;
+			if (candidate.empty.load(std::memory_order_relaxed) || !candidate.mut.try_lock())
+			{
+				continue; // contended or (probably) empty, just try two other heaps
+			}
+			std::optional<T> res;
+			if (!candidate.entries.empty()) // the cache may be outdated
+			{
+				res.emplace(pop_top(candidate));
+			}
+			candidate.mut.unlock();
+			if (res)
+			{
+				return res;
+			}
+		}
+
+		// we were unlucky or the queue is (almost) empty, so check every heap before reporting empty
+		for (heap& h : heaps)
+		{
+			std::lock_guard<spinlock_mutex> lock(h.mut);
+			if (!h.entries.empty())
+			{
+				return pop_top(h);
+			}
+		}
+		return std::nullopt;
+	}
+
+	void push_strict(Priority priority, T value)
+	{
+		thread_local std::uint64_t next_sequence = 0;
+		std::unique_ptr<T> p = std::make_unique<T>(std::move(value));
+		strict_entries.insert(strict_key{ priority, this_thread_index(), next_sequence++ }, p.get()); // the key is unique, this can't fail
+		p.release();
+	}
+
+	std::optional<T> try_pop_min_strict()
+	{
+		std::optional<std::pair<strict_key, T*>> front = strict_entries.try_pop_front();
+		if (!front)
+		{
+			return std::nullopt;
+		}
+		std::unique_ptr<T> p(front->second);
+		return std::move(*p);
+	}
+
+public:
+
+	explicit threadsafe_priority_queue(std::size_t num_heaps = 2 * std::max(1u, std::thread::hardware_concurrency()),
+		bool relaxed_ = false, Compare comp_ = Compare())
+		: heaps(relaxed_ ? std::max<std::size_t>(num_heaps, 1) : 0), strict_entries(strict_key_order{ comp_ }), relaxed(relaxed_), comp(std::move(comp_)) {}
+
+	~threadsafe_priority_queue()
+	{
+		while (std::optional<std::pair<strict_key, T*>> front = strict_entries.try_pop_front())
+		{
+			delete front->second;
+		}
+	}
+
+	threadsafe_priority_queue(const threadsafe_priority_queue& other) = delete;
+	threadsafe_priority_queue& operator=(const threadsafe_priority_queue& other) = delete;
+
+	void push(Priority priority, T value)
+	{
+		if (!relaxed)
+		{
+			push_strict(priority, std::move(value));
+			return;
+		}
+		heap* h = &random_heap();
+		while (!h->mut.try_lock())
+		{
+			cpu_relax();
+			h = &random_heap(); // don't wait for a busy heap, any other one is just as good
+		}
+		h->entries.push_back(entry{ priority, std::move(value) });
+		std::push_heap(h->entries.begin(), h->entries.end(), [this](const entry& a, const entry& b) { return heap_order(a, b); });
+		update_cached_top(*h);
+		h->mut.unlock();
+	}
+
+	std::optional<T> try_pop_min()
+	{
+		return relaxed ? try_pop_min_relaxed() : try_pop_min_strict();
+	}
+
+	bool try_pop_min(T& out_val)
+	{
+		std::optional<T> res = try_pop_min();
+		if (!res)
+		{
+			return false;
+		}
+		out_val = std::move(*res);
+		return true;
+	}
+};
@@ -1,6 +1,9 @@
 #pragma once
+#include <cstddef>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <utility>
 
 template<typename T>
 class threadsafe_queue
@@ -11,9 +14,24 @@ public:
 	threadsafe_queue(const threadsafe_queue& other) = delete;
 	threadsafe_queue& operator=(const threadsafe_queue& other) = delete;
 
-	std::shared_ptr<T> try_pop();
+	// values are stored inline in the nodes, so push/emplace allocate a single node and
+	// try_pop doesn't allocate at all
+	std::optional<T> try_pop();
+	bool try_pop(T& out_val);
 	void push(T new_value);
 
+	template<typename... Args>
+	void emplace(Args&&... args);
+
+	// pushes all elements of [first, last) with a single acquisition of tail_mutex
+	template<typename InputIt>
+	void push_range(InputIt first, InputIt last);
+
+	// pops up to max_n elements with a single acquisition of head_mutex (and tail_mutex),
+	// moves them into out and returns how many were popped
+	template<typename OutputIt>
+	std::size_t try_pop_bulk(OutputIt out, std::size_t max_n);
+
 private:
 
 	std::mutex head_mutex;
@@ -21,11 +39,8 @@ private:
 
 	struct node
 	{
-		std::shared_ptr<T> data;
+		std::optional<T> data; // empty in the dummy node
 		std::unique_ptr<node> next;
-
-		node(T data_) : data(std::move(data_)) {}
-		node() = default;
 	};
 
 	node* get_tail();
@@ -36,20 +51,43 @@ private:
 };
 
 template<typename T>
-inline std::shared_ptr<T> threadsafe_queue<T>::try_pop()
+inline std::optional<T> threadsafe_queue<T>::try_pop()
 {
 	auto old_head = pop_head();
-	return old_head ? old_head->data : nullptr; // no lock required anymore, node is already removed from data structure
+	if (!old_head)
+	{
+		return std::nullopt;
+	}
+	return std::move(old_head->data); // no lock required anymore, node is already removed from data structure
+}
+
+template<typename T>
+inline bool threadsafe_queue<T>::try_pop(T& out_val)
+{
+	auto old_head = pop_head();
+	if (!old_head)
+	{
+		return false;
+	}
+	out_val = std::move(*old_head->data);
+	return true;
 }
 
 template<typename T>
 inline void threadsafe_queue<T>::push(T new_value)
+{
+	emplace(std::move(new_value));
+}
+
+template<typename T>
+template<typename... Args>
+inline void threadsafe_queue<T>::emplace(Args&&... args)
 {
 	auto p = std::make_unique<node>();						// new dummy node
-	auto data = std::make_shared<T>(std::move(new_value));
+	T data(std::forward<Args>(args)...);					// construct outside of the lock, only move under it
 	node* new_tail = p.get();
 	std::lock_guard<std::mutex> tail_lock(tail_mutex);
-	tail->data = data;										// move data into previous dummy node
+	tail->data.emplace(std::move(data));					// move data into previous dummy node
 	tail->next = std::move(p);
 	tail = new_tail;
 }
@@ -73,3 +111,62 @@ inline std::unique_ptr<typename threadsafe_queue<T>::node> threadsafe_queue<T>::
 	head = std::move(old_head->next);
 	return old_head;
 }
+
+template<typename T>
+template<typename InputIt>
+inline void threadsafe_queue<T>::push_range(InputIt first, InputIt last)
+{
+	if (first == last)
+	{
+		return;
+	}
+
+	// build the whole chain before taking the lock. The first value goes into the current dummy node,
+	// every following value goes into the previous chain node and the last chain node is the new dummy.
+	T first_data(*first);
+	auto chain = std::make_unique<node>();
+	node* new_tail = chain.get();
+	for (++first; first != last; ++first)
+	{
+		new_tail->data.emplace(*first);
+		new_tail->next = std::make_unique<node>();
+		new_tail = new_tail->next.get();
+	}
+
+	std::lock_guard<std::mutex> tail_lock(tail_mutex);
+	tail->data.emplace(std::move(first_data));
+	tail->next = std::move(chain);
+	tail = new_tail;
+}
+
+template<typename T>
+template<typename OutputIt>
+inline std::size_t threadsafe_queue<T>::try_pop_bulk(OutputIt out, std::size_t max_n)
+{
+	std::unique_ptr<node> detached;
+	std::size_t count = 0;
+	{
+		std::lock_guard<std::mutex> head_lock(head_mutex);
+		node* const current_tail = get_tail(); // pushes after this point are not popped, that's fine
+		node* last = nullptr;
+		for (node* n = head.get(); count < max_n && n != current_tail; n = n->next.get())
+		{
+			last = n;
+			++count;
+		}
+		if (!last)
+		{
+			return 0;
+		}
+		detached = std::move(head);
+		head = std::move(last->next);
+	}
+
+	// no lock required anymore, the nodes are already removed from the data structure
+	while (detached)
+	{
+		*out++ = std::move(*detached->data);
+		detached = std::move(detached->next); // unlink one by one instead of recursively destroying the chain
+	}
+	return count;
+}
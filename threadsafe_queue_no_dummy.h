@@ -1,6 +1,8 @@
 #pragma once
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <utility>
 
 template <typename T>
 class threadsafe_queue_no_dummy
@@ -12,13 +14,17 @@ public:
 	threadsafe_queue_no_dummy& operator=(threadsafe_queue_no_dummy& other) = delete;
 
 	void push(T val);
-	std::shared_ptr<T> try_pop();
+	template <typename... Args>
+	void emplace(Args&&... args);
+	std::optional<T> try_pop();
+	bool try_pop(T& out_val);
 
 private:
 
 	struct node
 	{
-		node(T val) : data(val), next(nullptr) {}
+		template <typename... Args>
+		node(Args&&... args) : data(std::forward<Args>(args)...), next(nullptr) {}
 		T data;
 		std::unique_ptr<node> next;
 	};
@@ -27,13 +33,20 @@ private:
 	mutable std::mutex tail_mut;
 
 	std::unique_ptr<node> head;
-	node* tail;
+	node* tail = nullptr;
 };
 
 template<typename T>
 void threadsafe_queue_no_dummy<T>::push(T val)
 {
-	std::unique_ptr<node> p(new node(std::move(val));
+	emplace(std::move(val));
+}
+
+template<typename T>
+template<typename... Args>
+void threadsafe_queue_no_dummy<T>::emplace(Args&&... args)
+{
+	auto p = std::make_unique<node>(std::forward<Args>(args)...);
 	node* const new_tail = p.get();
 	std::scoped_lock tail_lock(tail_mut);
 	if (tail)
@@ -49,15 +62,27 @@ void threadsafe_queue_no_dummy<T>::push(T val)
 }
 
 template<typename T>
-std::shared_ptr<T> threadsafe_queue_no_dummy<T>::try_pop()
+bool threadsafe_queue_no_dummy<T>::try_pop(T& out_val)
+{
+	std::optional<T> res = try_pop();
+	if (!res)
+	{
+		return false;
+	}
+	out_val = std::move(*res);
+	return true;
+}
+
+template<typename T>
+std::optional<T> threadsafe_queue_no_dummy<T>::try_pop()
 {
 	std::scoped_lock head_lock(head_mut);
 	if (!head)
 	{
-		return nullptr;
+		return std::nullopt;
 	}
 
-	std::shared_ptr res = std::make_shared<T>(std::move(head->data));
+	std::optional<T> res(std::move(head->data));
 	std::unique_ptr<node> old_head(std::move(head));
 	head = std::move(old_head->next);
 	if(!head)